@@ -0,0 +1,143 @@
+// Reproducible render benchmarks: the sample functions of FUN.cpp, each over
+// its default window, rendered at several resolutions, thread counts and tile
+// sizes (the measurements in TODO.md, "Refine Algorithm"). Prints JSON:
+//   ms           best wall time of the runs
+//   pix_per_ms   pixels per ms of wall time
+//   phase_ms     worker time per renderTile phase (0-3 preview, 4 full, 5
+//                antialias), summed over threads, of the best run
+//   efficiency   speedup over the fewest threads, divided by the thread ratio
+//
+// usage: it-bench-render [--sizes 500,1000] [--threads 1,2,4] [--tiles 25,50,100]
+//                        [--runs 3] [--functions "Sample Quadratic,..."] [-o out.json]
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QFile>
+#include <QThread>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "Function.h"
+#include "State.h"
+#include "Colormap.h"
+#include "Render.h"
+
+Function *createBuiltinFunction(const std::string &name);
+
+static std::vector<int> intList(const QString &s) {
+  std::vector<int> v;
+  for (const QString &p: s.split(',', Qt::SkipEmptyParts)) if (p.toInt() > 0) v.push_back(p.toInt());
+  return v;
+}
+
+int main(int argc, char *argv[]) {
+  QCoreApplication app(argc, argv);
+  int cores = std::max(1, QThread::idealThreadCount());
+  QString allThreads = "1";
+  for (int n = 2; n < cores; n *= 2) allThreads += QString(",%1").arg(n);
+  if (cores > 1) allThreads += QString(",%1").arg(cores);
+
+  QCommandLineParser parser;
+  parser.addHelpOption();
+  QCommandLineOption sizesOpt("sizes", "Image edges in pixels.", "list", "500,1000");
+  QCommandLineOption threadsOpt("threads", "Thread counts (default 1, powers of 2, all cores).", "list", allThreads);
+  QCommandLineOption tilesOpt("tiles", "Tile sizes.", "list", "25,50,100");
+  QCommandLineOption runsOpt("runs", "Runs per measurement, the best counts.", "n", "3");
+  QCommandLineOption functionsOpt("functions", "Builtin functions, comma separated.", "list",
+    "Sample Quadratic,Sample Newton,Sample Milnor,Sample Tangent,Sample CentExponential");
+  QCommandLineOption outputOpt({"o", "output"}, "Write the JSON to a file instead of stdout.", "file");
+  parser.addOptions({sizesOpt, threadsOpt, tilesOpt, runsOpt, functionsOpt, outputOpt});
+  parser.process(app);
+
+  std::vector<int> sizes = intList(parser.value(sizesOpt));
+  std::vector<int> threads = intList(parser.value(threadsOpt));
+  std::vector<int> tiles = intList(parser.value(tilesOpt));
+  int runs = std::max(1, parser.value(runsOpt).toInt());
+  std::sort(threads.begin(), threads.end());
+
+  std::vector<Renderer*> renderers; // one scheduler per thread count
+  for (int n: threads) {
+    renderers.push_back(new Renderer(n));
+    renderers.back()->profile = true;
+  }
+
+  QJsonArray results;
+  for (const QString &name: parser.value(functionsOpt).split(',', Qt::SkipEmptyParts)) {
+    Function *f = createBuiltinFunction(name.trimmed().toStdString());
+    if (f == nullptr) {
+      fprintf(stderr, "unknown function: %s\n", qPrintable(name));
+      return 1;
+    }
+    f->defaults();
+    for (int size: sizes) {
+      Colormap colormap; // setColors may write to it
+      State state(f, &colormap, size, size);
+      state.getRangeFromFunction();
+      f->state = &state;
+      f->setColors();
+      for (int tile: tiles) {
+        state.setTiling(tile);
+        double basems = 0;
+        for (size_t t = 0; t < threads.size(); t++) {
+          Renderer *renderer = renderers[t];
+          renderer->tilesize = tile;
+          double best = 1e30;
+          QJsonArray phases;
+          for (int r = 0; r < runs; r++) {
+            state.clear();
+            QElapsedTimer timer;
+            timer.start();
+            renderer->start(f, &state);
+            renderer->wait();
+            double msec = timer.nsecsElapsed() / 1e6;
+            renderer->finish();
+            if (msec >= best) continue;
+            best = msec;
+            phases = QJsonArray();
+            for (auto &ns: renderer->phaseNanos) phases.append(ns.load() / 1e6);
+          }
+          if (t == 0) basems = best;
+          double efficiency = (basems * threads[0]) / (best * threads[t]);
+          QJsonObject o;
+          o["function"] = name.trimmed();
+          o["size"] = size;
+          o["tilesize"] = tile;
+          o["threads"] = threads[t];
+          o["ms"] = best;
+          o["pix_per_ms"] = (double)size * size / best;
+          o["phase_ms"] = phases;
+          o["efficiency"] = efficiency;
+          results.append(o);
+          fprintf(stderr, "%-24s %5d tile %3d %3d threads %10.1f ms %10.0f pix/ms  eff %.2f\n",
+            qPrintable(name.trimmed()), size, tile, threads[t], best, (double)size * size / best, efficiency);
+        }
+      }
+      f->state = nullptr;
+    }
+  }
+  for (Renderer *r: renderers) delete r;
+
+  QJsonObject doc;
+  doc["cores"] = cores;
+  doc["runs"] = runs;
+  doc["qt"] = qVersion();
+  doc["results"] = results;
+  QByteArray json = QJsonDocument(doc).toJson();
+  if (parser.isSet(outputOpt)) {
+    QFile file(parser.value(outputOpt));
+    if (!file.open(QIODevice::WriteOnly)) {
+      fprintf(stderr, "could not write %s\n", qPrintable(parser.value(outputOpt)));
+      return 1;
+    }
+    file.write(json);
+  } else {
+    fwrite(json.constData(), 1, json.size(), stdout);
+  }
+  return 0;
+}
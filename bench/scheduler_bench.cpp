@@ -0,0 +1,113 @@
+// Compares the render scheduler against the two QThreadPool based ways
+// ItView used to render:
+//   pool      50x50 tiles, each phase resubmitted to QThreadPool::globalInstance()
+//   stripes   one stripe per core, phase 4 only (the "#if 0 // STRIPES" path)
+//   scheduler 50x50 tiles on the work-stealing Scheduler (Renderer::start)
+//   tiled     the same, with State storing pixels in per-tile blocks
+//
+// usage: it-bench-scheduler [size] [runs] [function]
+//   e.g. it-bench-scheduler 4000 3 "Sample Quadratic"
+
+#include <QCoreApplication>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QThread>
+#include <QElapsedTimer>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "Function.h"
+#include "State.h"
+#include "Render.h"
+
+Function *createBuiltinFunction(const std::string &name);
+
+// Runs a Tile the way the old QRunnable did: one runnable per phase
+class PoolTile : public QRunnable {
+public:
+  Tile *tile;
+  QThreadPool *pool;
+  PoolTile(Tile *t, QThreadPool *p) { tile = t; pool = p; setAutoDelete(false); }
+  void run() override { if (tile->renderer->renderTile(tile)) pool->start(this); }
+};
+
+static double runPool(Renderer &renderer, Function *f, State *state, bool stripes) {
+  QThreadPool *pool = QThreadPool::globalInstance();
+  int w = state->getWidth(), h = state->getHeight();
+  std::vector<Tile*> tiles;
+  std::vector<PoolTile*> runnables;
+  QElapsedTimer timer;
+  timer.start();
+  renderer.begin(f, state);
+  if (stripes) {
+    int th = h / renderer.cores;
+    for (int y = 0; y < h; y += th) {
+      Tile *tile = new Tile(&renderer, 0, y, w, std::min(th, h - y), f->copy_());
+      tile->phase = 4;
+      tiles.push_back(tile);
+    }
+  } else {
+    int ts = renderer.tilesize;
+    for (int y = 0; y < h; y += ts)
+      for (int x = 0; x < w; x += ts)
+        tiles.push_back(new Tile(&renderer, x, y, std::min(ts, w - x), std::min(ts, h - y), f->copy_()));
+  }
+  for (Tile *tile: tiles) {
+    runnables.push_back(new PoolTile(tile, pool));
+    pool->start(runnables.back());
+  }
+  pool->waitForDone();
+  double msec = timer.nsecsElapsed() / 1e6;
+  renderer.rendering = false;
+  for (PoolTile *r: runnables) delete r;
+  for (Tile *tile: tiles) delete tile;
+  return msec;
+}
+
+static double runScheduler(Renderer &renderer, Function *f, State *state) {
+  QElapsedTimer timer;
+  timer.start();
+  renderer.start(f, state);
+  renderer.wait();
+  double msec = timer.nsecsElapsed() / 1e6;
+  renderer.finish();
+  return msec;
+}
+
+int main(int argc, char *argv[]) {
+  QCoreApplication app(argc, argv);
+  int size = argc > 1 ? atoi(argv[1]) : 1000;
+  int runs = argc > 2 ? atoi(argv[2]) : 3;
+  std::string name = argc > 3 ? argv[3] : "Sample Quadratic";
+
+  Function *f = createBuiltinFunction(name);
+  if (f == nullptr) {
+    fprintf(stderr, "unknown function: %s\n", name.c_str());
+    return 1;
+  }
+  int cores = std::max(1, QThread::idealThreadCount());
+  QThreadPool::globalInstance()->setMaxThreadCount(cores);
+  Renderer renderer(cores);
+  State state(f, nullptr, size, size);
+  state.getRangeFromFunction();
+  f->state = &state;
+  f->setColors();
+
+  printf("%s %dx%d, %d cores, best of %d\n", name.c_str(), size, size, cores, runs);
+  const char *modes[] = { "pool", "stripes", "scheduler", "tiled" };
+  for (int m = 0; m < 4; m++) {
+    double best = 1e30;
+    state.setTiling(m == 3 ? renderer.tilesize : 0);
+    for (int r = 0; r < runs; r++) {
+      state.clear();
+      double msec = m >= 2 ? runScheduler(renderer, f, &state) : runPool(renderer, f, &state, m == 1);
+
+      best = std::min(best, msec);
+    }
+    printf("%-10s %10.1f ms %10.0f pix/ms\n", modes[m], best, (double)size * size / best);
+  }
+  return 0;
+}
@@ -3,21 +3,42 @@
 # Argument 1: filename (without extension, e.g. "f_quadratic")
 # Argument 2: filesDirectory (~/Library/Application Support/It/)
 # Argument 3: main executable path (/Applications/It.app/Contents/MacOS/It)
+# Argument 4: CLEAN to rebuild the runtime and the precompiled prefix too
+# Argument 5: version (unused)
+# Argument 6: RELEASE (optimized, the default) or DEBUG (unoptimized, for a debugger)
+#
+# Only the function itself is compiled each time. The runtime (the it/
+# sources a function links with) is kept in libitrt.a and the prefix is
+# precompiled; both are rebuilt, in parallel, when their sources, the
+# executable or the flags change.
+#
+# Each profile has its own directory (build/release, build/debug) with its
+# runtime, prefix and the function library, so switching profiles does not
+# rebuild anything. It loads a copy of build/<profile>/<filename>.so.
+# A function opts in to -ffast-math with a line "#define IT_FAST_MATH".
+# IT_MARCH in the environment selects the instruction set (default native,
+# e.g. x86-64-v3 for libraries used on other machines).
 #
 DIR=${2:-${HOME}/It/}
 EXE=${3:-${HOME}/Code/it/build//Desktop_Qt_6_9_2-Debug/It}
-VER=${5:""}
+PROFILE=${6:-RELEASE}
 
 ARCH=`uname -m` # arm64 or x86_64
 COMPILER=`which c++`
 LINKER=${COMPILER}
-CPPFLAGS="-std=gnu++17 -g -fPIC"
+if [ "DEBUG" == "$PROFILE" ]; then
+  OUT=debug
+  CPPFLAGS="-std=gnu++17 -g -O0 -fPIC"
+else
+  OUT=release
+  CPPFLAGS="-std=gnu++17 -g -O3 -march=${IT_MARCH:-native} -fPIC"
+fi
 IFLAGS="-I../it"
 LFLAGS="-shared -L. -F."
+RUNTIME="Args Colormap Function State MTComplex MTQuad MTRandom debug"
 
 COMPILE="${COMPILER} ${CPPFLAGS} ${IFLAGS}"
 LINK="${LINKER} ${LFLAGS}"
-NEEDLINK="NO"
 
 if [ "$COMPILER" == "" ]; then
   echo "No compiler found" > "${DIR}build/errors.txt"
@@ -32,22 +53,18 @@ cd "$DIR"
 mkdir -p build
 cd build
 
-echo "Compiling $1"
+echo "Compiling $1 ($OUT)"
 
+mkdir -p $OUT
 if [ "CLEAN" == "$4" ]; then
   echo "Cleaning..."
-  rm -f *.o
-  rm -f "$1*.so"
+  rm -f $OUT/*.o $OUT/libitrt.a $OUT/itprefix.h $OUT/itprefix.h.gch $OUT/fast/* $OUT/flags.txt
+  rm -f "$OUT/$1.so"
 fi
-rm -f ITFUN.cpp
 rm -f errors.txt
 touch errors.txt
 
-#if [ -a "$1.so" -a "$1.so" -nt $EXE ]; then
-  rm -f "$1${VER}.so"
-#fi
-
-if [ ! -a prefix.txt ]; then
+if [ ! -e prefix.txt ]; then
 cat <<PREFIX > prefix.txt
 #include "Function.h"
 #include "State.h"
@@ -61,24 +78,68 @@ cat <<PREFIX > prefix.txt
 PREFIX
 fi
 
-#if [ ! -a "$1.so" -o "../$1.cpp" -nt "$1.so" ]; then
-  cat prefix.txt "../$1.cpp" > ITFUN.cpp
+# Objects and precompiled headers are only valid for the flags they were built with
+if [ "`cat $OUT/flags.txt 2>/dev/null`" != "${COMPILE}" ]; then
+  rm -f $OUT/libitrt.a $OUT/itprefix.h.gch $OUT/fast/itprefix.h.gch
+  echo "${COMPILE}" > $OUT/flags.txt
+fi
+stale() { # target missing or older than the executable or any it/ source
+  [ ! -e "$1" ] || [ -e "$EXE" -a "$EXE" -nt "$1" ] || [ -n "`find ../it -newer "$1" -print -quit`" ]
+}
+
+JOBS=""
+if stale $OUT/libitrt.a; then
+  echo "Building the runtime..."
+  for f in $RUNTIME; do
+    $COMPILE -c "../it/${f}.cpp" -o $OUT/${f}.o > $OUT/${f}.log 2>&1 &
+    JOBS="$JOBS $!"
+  done
+fi
+
+# Only for the function; never when linking, which would switch the whole
+# process to flush denormals (RGB pixels are stored as denormals)
+FASTMATH=""
+PCH=$OUT
+if grep -q '^[[:space:]]*#[[:space:]]*define[[:space:]]\{1,\}IT_FAST_MATH' "../$1.cpp"; then
+  FASTMATH="-ffast-math"
+  PCH=$OUT/fast # a header precompiled without it would not be used
+fi
+mkdir -p $PCH
+if stale $PCH/itprefix.h.gch || [ prefix.txt -nt $PCH/itprefix.h.gch ]; then
+  cp prefix.txt $PCH/itprefix.h
+  # under another name until complete, in case the compile is canceled
+  $COMPILE ${FASTMATH} -x c++-header $PCH/itprefix.h -o $PCH/itprefix.tmp.gch >> errors.txt 2>&1 && mv -f $PCH/itprefix.tmp.gch $PCH/itprefix.h.gch
+fi
+
+# Unchanged since the last build of this profile: nothing to do
+if stale "$OUT/$1.so" || [ "../$1.cpp" -nt "$OUT/$1.so" ] || [ prefix.txt -nt "$OUT/$1.so" ] || [ -n "$JOBS" ]; then
+  rm -f "$OUT/$1.so"
+  # The function source as it is, so that errors refer to its own lines
+  cp "../$1.cpp" ITFUN.cpp
   CLASSNAME=`grep -o 'CLASS([^,]*' ITFUN.cpp | sed s/CLASS\(//`
   POSTFIX1="extern \"C\" void *_createFunction(int pspace) { return new ${CLASSNAME}(\"${CLASSNAME}\", \"label\", pspace); }"
   POSTFIX2="extern \"C\" void _deleteFunction(void *f) { delete (${CLASSNAME} *)f; }"
+  echo >> ITFUN.cpp
   echo $POSTFIX1 >> ITFUN.cpp
   echo $POSTFIX2 >> ITFUN.cpp
-  $COMPILE -c ITFUN.cpp -o ITFUN.o >> errors.txt 2>&1
-#fi
+  $COMPILE ${FASTMATH} -include $PCH/itprefix.h -c ITFUN.cpp -o $OUT/ITFUN.o >> errors.txt 2>&1
 
-for f in Args Colormap Function State MTComplex MTRandom debug; do
-  if [ ! -a "${f}.o" -o "../it/${f}.cpp" -nt "${f}.o" ]; then
-    $COMPILE -c "../it/${f}.cpp" -o ${f}.o >> errors.txt 2>&1
-    NEEDLINK="YES"
+  if [ -n "$JOBS" ]; then
+    wait $JOBS
+    for f in $RUNTIME; do
+      cat $OUT/${f}.log >> errors.txt
+      rm -f $OUT/${f}.log
+    done
+    rm -f $OUT/libitrt.a
+    if [ ! -s errors.txt ]; then
+      ar rcs $OUT/libitrt.a `for f in $RUNTIME; do echo $OUT/${f}.o; done` >> errors.txt 2>&1
+    fi
   fi
-done
 
-$LINK ITFUN.o Args.o Colormap.o Function.o State.o MTComplex.o MTRandom.o debug.o -o "$1${VER}.so" >> errors.txt 2>&1
+  if [ ! -s errors.txt ]; then
+    $LINK $OUT/ITFUN.o -Wl,--whole-archive $OUT/libitrt.a -Wl,--no-whole-archive -o "$OUT/$1.tmp.so" >> errors.txt 2>&1 && mv -f "$OUT/$1.tmp.so" "$OUT/$1.so"
+  fi
+fi
 
 if [ ! -s errors.txt ]; then
     echo "Compiled successfully"
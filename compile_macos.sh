@@ -3,21 +3,45 @@
 # Argument 1: filename (without extension, e.g. "f_quadratic")
 # Argument 2: filesDirectory (~/Library/Application Support/It/)
 # Argument 3: main executable path (/Applications/It.app/Contents/MacOS/It)
+# Argument 4: CLEAN to rebuild the runtime and the precompiled prefix too
+# Argument 5: version (unused)
+# Argument 6: RELEASE (optimized, the default) or DEBUG (unoptimized, for a debugger)
+#
+# Only the function itself is compiled each time. The runtime (the it/
+# sources a function links with) is kept in libitrt.a and the prefix is
+# precompiled; both are rebuilt, in parallel, when their sources, the
+# executable or the flags change.
+#
+# Each profile has its own directory (build/release, build/debug) with its
+# runtime, prefix and the function library, so switching profiles does not
+# rebuild anything. A function opts in to -ffast-math with a line
+# "#define IT_FAST_MATH". IT_MARCH in the environment selects the CPU
+# (default native).
 #
 DIR=${2:-${HOME}/Library/Application\ Support/It/}
 EXE=${3:-${HOME}/Code/it3/build/Qt_6_9_2_for_macOS-Debug/It.app/Contents/MacOS/It}
+PROFILE=${6:-RELEASE}
 
 ARCH=`uname -m` # arm64 or x86_64
 COMPILER=`which c++`
 LINKER=${COMPILER}
-CPPFLAGS="-std=gnu++17 -arch ${ARCH} -g"
+if [ "DEBUG" == "$PROFILE" ]; then
+  OUT=debug
+  CPPFLAGS="-std=gnu++17 -arch ${ARCH} -g -O0"
+elif [ "arm64" == "$ARCH" ]; then
+  OUT=release
+  CPPFLAGS="-std=gnu++17 -arch ${ARCH} -g -O3 -mcpu=${IT_MARCH:-native}"
+else
+  OUT=release
+  CPPFLAGS="-std=gnu++17 -arch ${ARCH} -g -O3 -march=${IT_MARCH:-native}"
+fi
 IFLAGS="-I../it"
 #LFLAGS="-L /Library/Developer/CommandLineTools/SDKs/MacOSX.sdk/usr/lib -stdlib=libc++ -arch x86_64 -dynamiclib -L. -F. -w"
 LFLAGS="-stdlib=libc++ -arch ${ARCH} -dynamiclib -L. -F."
+RUNTIME="Args Colormap Function State MTComplex MTQuad MTRandom debug"
 
 COMPILE="${COMPILER} ${CPPFLAGS} ${IFLAGS}"
 LINK="${LINKER} ${LFLAGS}"
-NEEDLINK="NO"
 
 if [ "$COMPILER" == "" ]; then
   echo "No compiler found" > "${DIR}build/errors.txt"
@@ -32,22 +56,18 @@ cd "$DIR"
 mkdir -p build
 cd build
 
-echo "Compiling $1"
+echo "Compiling $1 ($OUT)"
 
+mkdir -p $OUT
 if [ "CLEAN" == "$4" ]; then
   echo "Cleaning..."
-  rm -f *.o
-  rm -f "$1.dylib"
+  rm -f $OUT/*.o $OUT/libitrt.a $OUT/itprefix.h $OUT/itprefix.h.pch $OUT/fast/* $OUT/flags.txt
+  rm -f "$OUT/$1.dylib"
 fi
-rm -f ITFUN.cpp
 rm -f errors.txt
 touch errors.txt
 
-#if [ -a "$1.dylib" -a "$1.dylib" -nt $EXE ]; then
-  rm -f "$1.dylib"
-#fi
-
-if [ ! -a prefix.txt ]; then
+if [ ! -e prefix.txt ]; then
 cat <<PREFIX > prefix.txt
 #include "Function.h"
 #include "State.h"
@@ -61,24 +81,67 @@ cat <<PREFIX > prefix.txt
 PREFIX
 fi
 
-#if [ ! -a "$1.dylib" -o "../$1.cpp" -nt "$1.dylib" ]; then
-  cat prefix.txt "../$1.cpp" > ITFUN.cpp
+# Objects and precompiled headers are only valid for the flags they were built with
+if [ "`cat $OUT/flags.txt 2>/dev/null`" != "${COMPILE}" ]; then
+  rm -f $OUT/libitrt.a $OUT/itprefix.h.pch $OUT/fast/itprefix.h.pch
+  echo "${COMPILE}" > $OUT/flags.txt
+fi
+stale() { # target missing or older than the executable or any it/ source
+  [ ! -e "$1" ] || [ -e "$EXE" -a "$EXE" -nt "$1" ] || [ -n "`find ../it -newer "$1" -print -quit`" ]
+}
+
+JOBS=""
+if stale $OUT/libitrt.a; then
+  echo "Building the runtime..."
+  for f in $RUNTIME; do
+    $COMPILE -c "../it/${f}.cpp" -o $OUT/${f}.o > $OUT/${f}.log 2>&1 &
+    JOBS="$JOBS $!"
+  done
+fi
+
+# Only for the function; the runtime keeps exact IEEE semantics
+FASTMATH=""
+PCH=$OUT
+if grep -q '^[[:space:]]*#[[:space:]]*define[[:space:]]\{1,\}IT_FAST_MATH' "../$1.cpp"; then
+  FASTMATH="-ffast-math"
+  PCH=$OUT/fast # a header precompiled without it cannot be used
+fi
+mkdir -p $PCH
+if stale $PCH/itprefix.h.pch || [ prefix.txt -nt $PCH/itprefix.h.pch ]; then
+  cp prefix.txt $PCH/itprefix.h
+  # under another name until complete, in case the compile is canceled
+  $COMPILE ${FASTMATH} -x c++-header $PCH/itprefix.h -o $PCH/itprefix.tmp.pch >> errors.txt 2>&1 && mv -f $PCH/itprefix.tmp.pch $PCH/itprefix.h.pch
+fi
+
+# Unchanged since the last build of this profile: nothing to do
+if stale "$OUT/$1.dylib" || [ "../$1.cpp" -nt "$OUT/$1.dylib" ] || [ prefix.txt -nt "$OUT/$1.dylib" ] || [ -n "$JOBS" ]; then
+  rm -f "$OUT/$1.dylib"
+  # The function source as it is, so that errors refer to its own lines
+  cp "../$1.cpp" ITFUN.cpp
   CLASSNAME=`grep -o 'CLASS([^,]*' ITFUN.cpp | sed s/CLASS\(//`
   POSTFIX1="extern \"C\" void *_createFunction(int pspace) { return new ${CLASSNAME}(\"${CLASSNAME}\", \"label\", pspace); }"
   POSTFIX2="extern \"C\" void _deleteFunction(void *f) { delete (${CLASSNAME} *)f; }"
+  echo >> ITFUN.cpp
   echo $POSTFIX1 >> ITFUN.cpp
   echo $POSTFIX2 >> ITFUN.cpp
-  $COMPILE -c ITFUN.cpp -o ITFUN.o >> errors.txt 2>&1
-#fi
+  $COMPILE ${FASTMATH} -include $PCH/itprefix.h -c ITFUN.cpp -o $OUT/ITFUN.o >> errors.txt 2>&1
 
-for f in Args Colormap Function State MTComplex MTRandom debug; do
-  if [ ! -a "${f}.o" -o "../it/${f}.cpp" -nt "${f}.o" ]; then
-    $COMPILE -c "../it/${f}.cpp" -o ${f}.o >> errors.txt 2>&1
-    NEEDLINK="YES"
+  if [ -n "$JOBS" ]; then
+    wait $JOBS
+    for f in $RUNTIME; do
+      cat $OUT/${f}.log >> errors.txt
+      rm -f $OUT/${f}.log
+    done
+    rm -f $OUT/libitrt.a
+    if [ ! -s errors.txt ]; then
+      ar rcs $OUT/libitrt.a `for f in $RUNTIME; do echo $OUT/${f}.o; done` >> errors.txt 2>&1
+    fi
   fi
-done
 
-$LINK ITFUN.o Args.o Colormap.o Function.o State.o MTComplex.o MTRandom.o debug.o -o "$1.dylib" >> errors.txt 2>&1
+  if [ ! -s errors.txt ]; then
+    $LINK $OUT/ITFUN.o -Wl,-force_load,$OUT/libitrt.a -o "$OUT/$1.tmp.dylib" >> errors.txt 2>&1 && mv -f "$OUT/$1.tmp.dylib" "$OUT/$1.dylib"
+  fi
+fi
 
 if [ ! -s errors.txt ]; then
     echo "Compiled successfully"
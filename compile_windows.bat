@@ -1,6 +1,15 @@
 @echo off
 REM Windows batch equivalent of the macOS build script
 REM
+REM Only the function itself is compiled each time: the runtime is kept in
+REM itrt.lib and the prefix is precompiled (itprefix.pch). CLEAN or new
+REM flags rebuild both.
+REM
+REM Each profile (RELEASE or DEBUG, argument 6) has its own directory,
+REM build\release or build\debug, so switching does not rebuild anything.
+REM A function opts in to /fp:fast with a line "#define IT_FAST_MATH".
+REM IT_MARCH in the environment adds /arch (e.g. AVX2) to release builds.
+REM
 REM Usage: compile.bat filename [filesDirectory] [mainExecutable] [CLEAN]
 REM Example: compile.bat f_quadratic
 REM Example: compile.bat f_quadratic "C:\MyApp\Data" "C:\MyApp\It.exe" CLEAN
@@ -71,9 +80,12 @@ REM CMAKE_CXX_FLAGS: -DQT_QML_DEBUG /DWIN32 /D_WINDOWS /W3 /GR /EHsc -DAPP_VERSI
 REM CMAKE_CXX_FLAGS_DEBUG: /MDd /Zi /Ob0 /Od /RTC1
 REM CMAKE_CXX_FLAGS_RELEASE: /MD /O2 /Ob2 /DNDEBUG
 if "%DEBUG%"=="DEBUG" (
+    set OUT=debug
     set CPPFLAGS=/std:c++17 /nologo /DWIN32 /D_WINDOWS /W3 /GR /EHsc -D_CRT_SECURE_NO_WARNINGS /MDd /Zi /Ob0 /Od /RTC1
 ) else (
+    set OUT=release
     set CPPFLAGS=/std:c++17 /nologo /DWIN32 /D_WINDOWS /W3 /GR /EHsc -D_CRT_SECURE_NO_WARNINGS /MD /O2 /Ob2 /DNDEBUG
+    if not "%IT_MARCH%"=="" set CPPFLAGS=!CPPFLAGS! /arch:%IT_MARCH%
 )
 set IFLAGS=/I..\it
 set LFLAGS=/DLL /MACHINE:%ARCH% /VERBOSE /nologo
@@ -95,19 +107,21 @@ cd /d "%DIR%"
 if not exist build mkdir build
 cd build
 
-echo Compiling %FILENAME%
+echo Compiling %FILENAME% (%OUT%)
+if not exist %OUT% mkdir %OUT%
 
 REM Clean if requested
 if "%CLEAN_FLAG%"=="CLEAN" (
     echo Cleaning...
-    del /q *.obj 2>nul
-    del /q "%FILENAME%.dll" 2>nul
+    del /q %OUT%\*.obj 2>nul
+    del /q %OUT%\itrt.lib %OUT%\itprefix.pch %OUT%\itprefix.h %OUT%\flags.txt 2>nul
+    del /q %OUT%\fast\* 2>nul
 )
 
 REM Remove old files
 del /q ITFUN.cpp 2>nul
 del /q errors.txt 2>nul
-del /q "%FILENAME%.dll" 2>nul
+del /q "%OUT%\%FILENAME%.dll" 2>nul
 
 REM Create errors.txt
 echo. > errors.txt
@@ -134,9 +148,66 @@ if not exist "..\%FILENAME%.cpp" (
     exit /b 1
 )
 
-REM Create ITFUN.cpp by combining prefix and source
+REM Objects and the precompiled prefix are only valid for the flags they were built with
+set "FLAGS=%CPPFLAGS% %IFLAGS%"
+set OLDFLAGS=
+if exist %OUT%\flags.txt set /p OLDFLAGS=<%OUT%\flags.txt
+if not "!OLDFLAGS!"=="!FLAGS!" (
+    del /q %OUT%\itrt.lib %OUT%\itprefix.pch %OUT%\fast\itprefix.pch 2>nul
+    >%OUT%\flags.txt echo !FLAGS!
+)
+
+REM Build the runtime once, all files in parallel
+set SOURCEFILES=Args Colormap Function State MTComplex MTQuad MTRandom debug
+if not exist %OUT%\itrt.lib (
+    echo Building the runtime...
+    set RUNTIMESOURCES=
+    set RUNTIMEOBJS=
+    for %%f in (%SOURCEFILES%) do (
+        set RUNTIMESOURCES=!RUNTIMESOURCES! ..\it\%%f.cpp
+        set RUNTIMEOBJS=!RUNTIMEOBJS! %OUT%\%%f.obj
+    )
+    cl.exe %CPPFLAGS% %IFLAGS% /MP /c !RUNTIMESOURCES! /Fo%OUT%\ >> errors.txt 2>&1
+    if errorlevel 1 (
+        echo Compilation of the runtime failed
+        goto :show_errors
+    )
+    lib.exe /nologo /OUT:%OUT%\itrt.lib !RUNTIMEOBJS! >> errors.txt 2>&1
+    if errorlevel 1 (
+        echo Could not create itrt.lib
+        goto :show_errors
+    )
+)
+
+REM Only the function is built with /fp:fast, which needs its own prefix
+set FASTMATH=
+set PCH=%OUT%
+findstr /r /c:"^[ 	]*#[ 	]*define[ 	][ 	]*IT_FAST_MATH" "..\%FILENAME%.cpp" >nul 2>&1
+if not errorlevel 1 (
+    set FASTMATH=/fp:fast
+    set PCH=%OUT%\fast
+)
+if not exist %PCH% mkdir %PCH%
+
+REM Precompile the prefix when it is new or has changed
+if exist %PCH%\itprefix.pch (
+    fc /b prefix.txt %PCH%\itprefix.h >nul 2>&1
+    if errorlevel 1 del /q %PCH%\itprefix.pch 2>nul
+)
+if not exist %PCH%\itprefix.pch (
+    echo Precompiling the prefix...
+    copy /y prefix.txt %PCH%\itprefix.h >nul
+    >%PCH%\itprefix.cpp echo #include "itprefix.h"
+    cl.exe %CPPFLAGS% %FASTMATH% %IFLAGS% /I%PCH% /c /Yc"itprefix.h" /Fp"%PCH%\itprefix.pch" %PCH%\itprefix.cpp /Fo:%PCH%\itprefix.obj >> errors.txt 2>&1
+    if errorlevel 1 (
+        echo Precompiling the prefix failed
+        goto :show_errors
+    )
+)
+
+REM ITFUN.cpp is the source as it is, so that errors refer to its own lines
 echo Creating ITFUN.cpp...
-copy /b prefix.txt + "..\%FILENAME%.cpp" ITFUN_temp.cpp >nul
+copy /b "..\%FILENAME%.cpp" ITFUN_temp.cpp >nul
 
 REM Extract class name from the source
 findstr /r "CLASS(" ITFUN_temp.cpp > temp_class.txt
@@ -166,48 +237,23 @@ echo Found class: %CLASSNAME%
 
 REM Compile ITFUN.cpp
 echo Compiling ITFUN.cpp...
-cl.exe %CPPFLAGS% %IFLAGS% /c ITFUN.cpp /Fo:ITFUN.obj >> errors.txt 2>&1
+cl.exe %CPPFLAGS% %FASTMATH% %IFLAGS% /I%PCH% /Yu"itprefix.h" /FI"itprefix.h" /Fp"%PCH%\itprefix.pch" /c ITFUN.cpp /Fo:%OUT%\ITFUN.obj >> errors.txt 2>&1
 if errorlevel 1 (
     echo Compilation failed for ITFUN.cpp
     goto :show_errors
 )
 
-REM Compile other source files
-set SOURCEFILES=Args Colormap Function State MTComplex MTRandom debug
-set OBJFILES=ITFUN.obj
-
-for %%f in (%SOURCEFILES%) do (
-    set SOURCEPATH=..\it\%%f.cpp
-    set OBJPATH=%%f.obj
-
-    if exist "!SOURCEPATH!" (
-        REM Check if we need to recompile (source newer than object)
-        set NEED_COMPILE=0
-        if not exist "!OBJPATH!" set NEED_COMPILE=1
-
-        REM Simple timestamp check - if source exists and obj doesn't, compile
-        if !NEED_COMPILE!==1 (
-            echo Compiling %%f.cpp...
-            cl.exe %CPPFLAGS% %IFLAGS% /c "!SOURCEPATH!" /Fo:!OBJPATH! >> errors.txt 2>&1
-            if errorlevel 1 (
-                echo Compilation failed for %%f.cpp
-                goto :show_errors
-            )
-        )
-        set OBJFILES=!OBJFILES! !OBJPATH!
-    )
-)
-
-REM Link
+REM Link under a temporary name, so a cancelled link leaves no partial DLL
 echo Linking %FILENAME%.dll...
-link.exe %LFLAGS% /OUT:%FILENAME%.dll %OBJFILES% >> errors.txt 2>&1
+link.exe %LFLAGS% /OUT:%OUT%\%FILENAME%.tmp.dll %OUT%\ITFUN.obj %PCH%\itprefix.obj /WHOLEARCHIVE:%OUT%\itrt.lib >> errors.txt 2>&1
 if errorlevel 1 (
     echo Linking failed
     goto :show_errors
 )
+move /y "%OUT%\%FILENAME%.tmp.dll" "%OUT%\%FILENAME%.dll" >nul
 
 REM Check for success
-if exist "%FILENAME%.dll" (
+if exist "%OUT%\%FILENAME%.dll" (
     echo.
     echo Compiled successfully
     exit /b 0
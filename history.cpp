@@ -0,0 +1,98 @@
+#include <QDir>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QDebug>
+
+#include "history.h"
+#include "State.h"
+
+History::History() {
+  budget = (qint64)256 << 20;
+  used = 0;
+  spill = nullptr;
+  spilled = 0;
+}
+
+History::~History() {
+  clear();
+  delete spill; // removes the spilled frames
+}
+
+void History::setBudget(qint64 bytes) {
+  budget = bytes;
+  spillOld();
+}
+
+void History::push(State *state) {
+  if (!entries.empty()) pack(entries.back());
+  entries.push_back({ state, QByteArray(), QString() });
+  spillOld();
+}
+
+State *History::back() {
+  if (entries.empty()) return nullptr;
+  unpack(entries.back());
+  return entries.back().state;
+}
+
+State *History::pop() {
+  State *state = back();
+  if (state) entries.pop_back();
+  return state;
+}
+
+void History::clear() {
+  for (Entry &e: entries) {
+    if (!e.file.isEmpty()) QFile::remove(e.file);
+    delete e.state;
+  }
+  entries.clear();
+  used = 0;
+}
+
+// Level 1: fast, and higher levels gain little on frames
+void History::pack(Entry &e) {
+  if (!e.state->hasFrame()) return;
+  QByteArray frame(e.state->frameSize(), Qt::Uninitialized);
+  e.state->writeFrame((byte *)frame.data());
+  e.packed = qCompress(frame, 1);
+  e.state->releaseFrame();
+  used += e.packed.size();
+}
+
+void History::unpack(Entry &e) {
+  if (e.state->hasFrame()) return;
+  if (!e.file.isEmpty()) {
+    QFile file(e.file);
+    if (file.open(QIODevice::ReadOnly)) e.packed = file.readAll();
+    file.remove();
+    e.file.clear();
+  } else {
+    used -= e.packed.size();
+  }
+  QByteArray frame = qUncompress(e.packed);
+  e.packed = QByteArray();
+  if (!e.state->readFrame((const byte *)frame.constData(), frame.size())) {
+    qDebug() << "Could not restore a frame of the history";
+    e.state->resize(e.state->getWidth(), e.state->getHeight()); // empty
+  }
+}
+
+// Oldest first; the files go when the frames come back or the app exits
+void History::spillOld() {
+  for (size_t i = 0; used > budget && i + 1 < entries.size(); i++) {
+    Entry &e = entries[i];
+    if (e.packed.isEmpty()) continue;
+    if (spill == nullptr) spill = new QTemporaryDir(QDir::tempPath() + "/it-history-XXXXXX");
+    if (!spill->isValid()) return;
+    QString name = spill->filePath(QString::number(spilled++));
+    QFile file(name);
+    if (!file.open(QIODevice::WriteOnly) || file.write(e.packed) != e.packed.size() || !file.flush()) {
+      file.remove();
+      return; // keep it in memory
+    }
+    used -= e.packed.size();
+    e.packed = QByteArray();
+    e.file = name;
+  }
+}
@@ -0,0 +1,42 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <QByteArray>
+#include <QString>
+#include <vector>
+
+class QTemporaryDir;
+class State;
+
+// The frames before the current one, for Back. Only the newest keeps its
+// pixels as they are, for the next frame to seed from; older ones are
+// compressed, and beyond the memory budget written to a temporary directory.
+// Frames are unpacked again as Back reaches them.
+class History {
+public:
+  History();
+  ~History();
+  void setBudget(qint64 bytes); // for compressed frames in memory
+  void push(State *state);      // takes ownership
+  State *back();                // newest, with its pixels; nullptr if empty
+  State *pop();                 // back(), now owned by the caller
+  size_t size() { return entries.size(); }
+  bool empty() { return entries.empty(); }
+  void clear();
+private:
+  struct Entry {
+    State *state;
+    QByteArray packed;    // compressed frame, if in memory
+    QString file;         // compressed frame, if spilled
+  };
+  std::vector<Entry> entries;
+  qint64 budget;
+  qint64 used;            // bytes of packed frames in memory
+  QTemporaryDir *spill;   // created on first use
+  int spilled;            // files written, for unique names
+  void pack(Entry &e);
+  void unpack(Entry &e);
+  void spillOld();
+};
+
+#endif // HISTORY_H
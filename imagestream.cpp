@@ -0,0 +1,268 @@
+#include "imagestream.h"
+#include <string.h>
+#include <ctype.h>
+#ifdef IT_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define IDAT_SIZE (1 << 20) // bytes per PNG data chunk
+
+static uint32_t crc(uint32_t c, const unsigned char *p, size_t n) {
+  static uint32_t table[256];
+  if (table[1] == 0) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t k = i;
+      for (int j = 0; j < 8; j++) k = (k & 1) ? 0xedb88320u ^ (k >> 1) : k >> 1;
+      table[i] = k;
+    }
+  }
+  c = ~c;
+  for (size_t i = 0; i < n; i++) c = table[(c ^ p[i]) & 0xff] ^ (c >> 8);
+  return ~c;
+}
+
+static void be32(unsigned char *p, uint32_t v) {
+  p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static void le16(unsigned char *p, uint32_t v) {
+  p[0] = v; p[1] = v >> 8;
+}
+
+static void le32(unsigned char *p, uint32_t v) {
+  p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+ImageStream::ImageStream(FILE *fp_, int width_, int height_) {
+  fp = fp_;
+  width = width_;
+  height = height_;
+  rows = 0;
+  ok = true;
+}
+
+ImageStream::~ImageStream() {
+  if (fp) fclose(fp);
+}
+
+bool ImageStream::put(const void *data, size_t n) {
+  ok = ok && fwrite(data, 1, n, fp) == n;
+  return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// RGB, 8 bits, every row with the Sub filter
+class PngStream : public ImageStream {
+public:
+  PngStream(FILE *fp, int width, int height);
+  ~PngStream();
+  bool writeRow(const uint32_t *row) override;
+  bool close() override;
+private:
+  void chunk(const char *type, const unsigned char *data, size_t n);
+  void compress(const unsigned char *p, size_t n, bool last);
+  std::vector<unsigned char> idat; // compressed, not yet written
+#ifdef IT_HAVE_ZLIB
+  z_stream z;
+#else
+  std::vector<unsigned char> block; // stored deflate block being filled
+  uint32_t adler;
+  void store(size_t n, bool last);
+#endif
+};
+
+PngStream::PngStream(FILE *fp, int width, int height) : ImageStream(fp, width, height) {
+  static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  put(signature, 8);
+  unsigned char ihdr[13];
+  be32(ihdr, width);
+  be32(ihdr + 4, height);
+  ihdr[8] = 8;  // bits per channel
+  ihdr[9] = 2;  // RGB
+  ihdr[10] = ihdr[11] = ihdr[12] = 0;
+  chunk("IHDR", ihdr, 13);
+  line.resize(1 + (size_t)width * 3);
+#ifdef IT_HAVE_ZLIB
+  memset(&z, 0, sizeof(z));
+  deflateInit(&z, Z_DEFAULT_COMPRESSION);
+#else
+  static const unsigned char header[2] = { 0x78, 0x01 };
+  idat.assign(header, header + 2);
+  adler = 1;
+#endif
+}
+
+PngStream::~PngStream() {
+#ifdef IT_HAVE_ZLIB
+  deflateEnd(&z);
+#endif
+}
+
+void PngStream::chunk(const char *type, const unsigned char *data, size_t n) {
+  unsigned char b[8];
+  be32(b, (uint32_t)n);
+  memcpy(b + 4, type, 4);
+  put(b, 8);
+  put(data, n);
+  be32(b, crc(crc(0, (const unsigned char *)type, 4), data, n));
+  put(b, 4);
+}
+
+bool PngStream::writeRow(const uint32_t *row) {
+  if (rows >= height) return false;
+  unsigned char *p = line.data();
+  p[0] = 1; // Sub: each byte minus the one of the pixel to the left
+  unsigned char prev[3] = { 0, 0, 0 };
+  for (int x = 0; x < width; x++) {
+    unsigned char rgb[3] = { (unsigned char)(row[x] >> 16), (unsigned char)(row[x] >> 8), (unsigned char)row[x] };
+    for (int c = 0; c < 3; c++) {
+      p[1 + 3 * x + c] = rgb[c] - prev[c];
+      prev[c] = rgb[c];
+    }
+  }
+  rows++;
+  compress(p, line.size(), rows == height);
+  if (idat.size() >= IDAT_SIZE) {
+    chunk("IDAT", idat.data(), idat.size());
+    idat.clear();
+  }
+  return ok;
+}
+
+#ifdef IT_HAVE_ZLIB
+void PngStream::compress(const unsigned char *p, size_t n, bool last) {
+  unsigned char buf[65536];
+  z.next_in = (Bytef *)p;
+  z.avail_in = (uInt)n;
+  int ret;
+  do {
+    z.next_out = buf;
+    z.avail_out = sizeof(buf);
+    ret = deflate(&z, last ? Z_FINISH : Z_NO_FLUSH);
+    idat.insert(idat.end(), buf, buf + sizeof(buf) - z.avail_out);
+  } while (last ? ret == Z_OK : z.avail_in > 0 || z.avail_out == 0);
+  if (ret == Z_STREAM_ERROR) ok = false;
+}
+#else
+// Deflate without compression: stored blocks of up to 65535 bytes
+void PngStream::compress(const unsigned char *p, size_t n, bool last) {
+  uint32_t a = adler & 0xffff, b = adler >> 16;
+  for (size_t i = 0; i < n; i++) {
+    a = (a + p[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  adler = (b << 16) | a;
+  block.insert(block.end(), p, p + n);
+  while (block.size() >= 65535) store(65535, last && block.size() == 65535);
+  if (last && !block.empty()) store(block.size(), true);
+  if (last) {
+    unsigned char t[4];
+    be32(t, adler);
+    idat.insert(idat.end(), t, t + 4);
+  }
+}
+
+void PngStream::store(size_t n, bool last) {
+  unsigned char h[5] = { (unsigned char)(last ? 1 : 0) };
+  le16(h + 1, (uint32_t)n);
+  le16(h + 3, (uint32_t)(~n & 0xffff));
+  idat.insert(idat.end(), h, h + 5);
+  idat.insert(idat.end(), block.begin(), block.begin() + n);
+  block.erase(block.begin(), block.begin() + n);
+}
+#endif
+
+bool PngStream::close() {
+  if (rows != height) ok = false;
+  if (!idat.empty()) chunk("IDAT", idat.data(), idat.size());
+  idat.clear();
+  chunk("IEND", nullptr, 0);
+  ok = fclose(fp) == 0 && ok;
+  fp = nullptr;
+  return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Baseline RGB TIFF: one uncompressed strip right after the header
+class TiffStream : public ImageStream {
+public:
+  TiffStream(FILE *fp, int width, int height);
+  bool writeRow(const uint32_t *row) override;
+  bool close() override;
+};
+
+#define TIFF_ENTRIES 10
+#define TIFF_BITS (8 + 2 + TIFF_ENTRIES * 12 + 4) // offset of BitsPerSample
+#define TIFF_DATA (TIFF_BITS + 6)
+
+TiffStream::TiffStream(FILE *fp, int width, int height) : ImageStream(fp, width, height) {
+  unsigned char h[TIFF_DATA];
+  memset(h, 0, sizeof(h));
+  h[0] = h[1] = 'I';
+  le16(h + 2, 42);
+  le32(h + 4, 8);
+  le16(h + 8, TIFF_ENTRIES);
+  static const struct { int tag, type; } tags[TIFF_ENTRIES] = {
+    { 256, 4 }, { 257, 4 }, { 258, 3 }, { 259, 3 }, { 262, 3 },
+    { 273, 4 }, { 277, 3 }, { 278, 4 }, { 279, 4 }, { 284, 3 }
+  };
+  uint32_t values[TIFF_ENTRIES] = {
+    (uint32_t)width, (uint32_t)height, TIFF_BITS, 1 /* no compression */, 2 /* RGB */,
+    TIFF_DATA, 3, (uint32_t)height, (uint32_t)width * height * 3, 1 /* interleaved */
+  };
+  for (int i = 0; i < TIFF_ENTRIES; i++) {
+    unsigned char *e = h + 10 + 12 * i;
+    le16(e, tags[i].tag);
+    le16(e + 2, tags[i].type);
+    le32(e + 4, tags[i].tag == 258 ? 3 : 1);
+    if (tags[i].type == 3 && tags[i].tag != 258) le16(e + 8, values[i]);
+    else le32(e + 8, values[i]);
+  }
+  for (int c = 0; c < 3; c++) le16(h + TIFF_BITS + 2 * c, 8);
+  put(h, sizeof(h));
+  line.resize((size_t)width * 3);
+}
+
+bool TiffStream::writeRow(const uint32_t *row) {
+  if (rows >= height) return false;
+  unsigned char *p = line.data();
+  for (int x = 0; x < width; x++) {
+    p[3 * x] = row[x] >> 16;
+    p[3 * x + 1] = row[x] >> 8;
+    p[3 * x + 2] = row[x];
+  }
+  rows++;
+  return put(p, line.size());
+}
+
+bool TiffStream::close() {
+  if (rows != height) ok = false;
+  ok = fclose(fp) == 0 && ok;
+  fp = nullptr;
+  return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+ImageStream *ImageStream::create(const std::string &file, int width, int height, std::string &error) {
+  std::string ext = file.substr(file.find_last_of('.') == std::string::npos ? file.size() : file.find_last_of('.'));
+  for (char &c: ext) c = tolower(c);
+  bool png = ext == ".png", tiff = ext == ".tif" || ext == ".tiff";
+  if (!png && !tiff) {
+    error = "streamed output must be .png, .tif or .tiff";
+    return nullptr;
+  }
+  if (tiff && (uint64_t)width * height * 3 + TIFF_DATA > 0xffffffffull) {
+    error = "image too large for TIFF (4 GB), use .png";
+    return nullptr;
+  }
+  FILE *fp = fopen(file.c_str(), "wb");
+  if (fp == nullptr) {
+    error = "could not write " + file;
+    return nullptr;
+  }
+  if (png) return new PngStream(fp, width, height);
+  return new TiffStream(fp, width, height);
+}
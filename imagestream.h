@@ -0,0 +1,32 @@
+#ifndef IMAGESTREAM_H
+#define IMAGESTREAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Writes an RGB image row by row, top to bottom, so that images larger than
+// memory (posters, see it-render --band) never have to exist as a whole.
+// PNG is deflated with zlib when it-render is built with it (IT_HAVE_ZLIB),
+// else stored uncompressed; TIFF is baseline, uncompressed, up to 4 GB.
+class ImageStream {
+public:
+  // By the extension of file: .png, .tif or .tiff; nullptr and error if not
+  static ImageStream *create(const std::string &file, int width, int height, std::string &error);
+  virtual ~ImageStream();
+  // One row of 0xffRRGGBB pixels
+  virtual bool writeRow(const uint32_t *row) = 0;
+  // After the last row: flush and close; false on any write error
+  virtual bool close() = 0;
+protected:
+  ImageStream(FILE *fp, int width, int height);
+  bool put(const void *data, size_t n);
+  FILE *fp;
+  int width, height;
+  int rows;          // written so far
+  bool ok;
+  std::vector<unsigned char> line;
+};
+
+#endif // IMAGESTREAM_H
@@ -17,7 +17,10 @@
 #include "State.h"
 #include "Algo.h"
 #include "MTRandom.h"
+#include "MTQuad.h"
 #include <stdio.h>
+#include <math.h>
+#include <vector>
 
 void requestRedraw() {} // global function that requests a redraw
 
@@ -43,14 +46,19 @@ void Algorithm::piece(int part, int parts, Function *f) {
     int chunk = yres / parts;
     int start = chunk * part;
     int end = part == parts - 1 ? yres : chunk * (part + 1);
+    std::vector<double> xs(xres), out(xres);
+    for (int x = 0; x < xres; x++) xs[x] = state->X(x);
     for (int y = start; y < end; y++) {
-      for (int x = 0; x < xres; x++) {
-        state->setPixel(x, y, f->iterate(state->X(x), state->Y(y)));
-      }
+      computeRow(f, xs.data(), 0, y, xres, out.data());
+      state->setPixelRow(0, y, out.data(), xres);
     }  
   }
 }
 
+void Algorithm::computeRow(Function *f, const double *xs, int x, int y, int n, double *out) {
+  f->iterateRow(xs, state->Y(y), out, n);
+}
+
 void Algorithm::stop() {
   running = false;
 }
@@ -135,6 +143,173 @@ public:
   }
 };
 
+/*
+ * Perturbation for z -> z^2 + c (the "depth", "escape" and "C" arguments
+ * of SampleQuadratic). One reference orbit Z at the center in quad-double,
+ * every pixel as a double delta: d' = (2Z + d) d + dc. A cubic series
+ * d = A e + B e^2 + C e^3 in the pixel offset e skips the first
+ * iterations. When |z - Z[0]| < |d| or the reference ends, the pixel is
+ * rebased onto the start of the reference orbit (Zhuoran's glitch fix).
+ */
+class Perturbation : public Algorithm {
+  int depth;
+  double escape2;
+  int pspace;
+  std::vector<complex> Z;   // reference orbit, Z[0] is the start point
+  complex A, B, C;          // series coefficients at iteration skip
+  int skip;                 // iterations covered by the series
+public:
+  Perturbation() : Algorithm("Perturbation") { }
+  void init(Function *f) {
+    prepare(f);
+  }
+  void run(Function *f) {
+    std::vector<double> out(xres);
+    for (int y = 0; y < yres; y++) {
+      computeRow(f, nullptr, 0, y, xres, out.data());
+      state->setPixelRow(0, y, out.data(), xres);
+
+      if (!running) return;
+    }
+  }
+  void prepare(Function *f) {
+    depth = f->args.getInt("depth");
+    double escape = f->args.getDouble("escape");
+    escape2 = escape * escape;
+    pspace = f->pspace;
+    qcomplex z, c;
+    if (pspace == 1) {
+      c = qcomplex(state->centerx, state->centery);
+    } else {
+      complex k = f->args.getComplex("C");
+      z = qcomplex(state->centerx, state->centery);
+
+      c = qcomplex(qdouble(k.re), qdouble(k.im));
+    }
+    Z.clear();
+    Z.push_back(complex(z.re.toDouble(), z.im.toDouble()));
+    for (int i = 0; i < depth; i++) {
+      z = sqr(z) + c;
+      complex zd(z.re.toDouble(), z.im.toDouble());
+      Z.push_back(zd);
+      if (norm(zd) > escape2) break;
+    }
+    series();
+  }
+  // Largest pixel offset is at the corners
+  void series() {
+    double r = 0.5 * hypot(state->spanx, state->spany);
+    double r2 = r * r;
+    complex dc = pspace == 1 ? complex(1, 0) : complex(0, 0);
+    A = pspace == 1 ? complex(0, 0) : complex(1, 0);
+    B = C = complex(0, 0);
+    skip = 0;
+    while (skip + 2 < (int)Z.size()) {
+      complex z2 = 2.0 * Z[skip];
+      complex a = z2 * A + dc;
+      complex b = z2 * B + A * A;
+      complex c = z2 * C + 2.0 * A * B;
+      // stop when the linear term no longer dominates or pixels could escape
+      double la = sqrt(norm(a));
+      if (la == 0.0 || sqrt(norm(b)) * r > 1e-3 * la) break;
+      if (sqrt(norm(c)) * r2 > 1e-12 * la) break;
+
+      if (norm(Z[skip + 1]) > 4.0) break;
+      A = a; B = b; C = c;
+      skip++;
+    }
+  }
+  void computeRow(Function *f, const double *xs, int x, int y, int n, double *out) {
+    double ey = state->dY(y);
+    int last = (int)Z.size() - 1;
+    for (int k = 0; k < n; k++) {
+      complex e(state->dX(x + k), ey);
+
+      complex dc = pspace == 1 ? e : complex(0, 0);
+      complex d = ((C * e + B) * e + A) * e;
+      // inner loop spelled out, complex operators are not inlined
+      double dr = d.re, di = d.im, cr = dc.re, ci = dc.im;
+      int m = skip, i;
+      for (i = skip; i < depth; i++) {
+        double tr = 2.0 * Z[m].re + dr, ti = 2.0 * Z[m].im + di;
+        double nr = tr * dr - ti * di + cr;
+        di = tr * di + ti * dr + ci;
+        dr = nr;
+        m++;
+        double zr = Z[m].re + dr, zi = Z[m].im + di;
+        if (zr * zr + zi * zi > escape2) break;
+        double rr = zr - Z[0].re, ri = zi - Z[0].im;
+        if (rr * rr + ri * ri < dr * dr + di * di || m == last) {
+          dr = rr; di = ri;
+          m = 0;
+        }
+      }
+      out[k] = (double)i / depth;
+
+    }
+  }
+};
+
+/*
+ * Mariani-Silver on the whole image; the Renderer does the same per tile
+ * for every Function with subdivide set.
+ */
+class MarianiSilver : public Algorithm {
+  std::vector<double> xs, out;
+public:
+  MarianiSilver() : Algorithm("Mariani-Silver") { }
+  void init(Function *f) {
+    xs.resize(xres);
+    out.resize(xres);
+    for (int x = 0; x < xres; x++) xs[x] = state->X(x);
+  }
+  void run(Function *f) {
+    subdivideRect(state, 0, 0, xres, yres, [&](int x, int y, int n) {
+      computeRow(f, xs.data() + x, x, y, n, out.data());
+      for (int i = 0; i < n; i++) if (!state->isSet(x + i, y)) state->setPixel(x + i, y, out[i]);
+      return running;
+    });
+  }
+};
+
+bool subdivideRect(State *state, int x, int y, int w, int h, const std::function<bool(int, int, int)> &row) {
+  if (w < 4 || h < 4) { // small: compute everything
+    for (int j = y; j < y + h; j++) if (!row(x, j, w)) return false;
+    return true;
+  }
+  if (!row(x, y, w) || !row(x, y + h - 1, w)) return false;
+  for (int j = y + 1; j < y + h - 1; j++) {
+    if (!row(x, j, 1) || !row(x + w - 1, j, 1)) return false;
+  }
+  double v = state->getPixel(x, y);
+  bool uniform = true;
+  for (int i = x; uniform && i < x + w; i++) {
+    uniform = state->getPixel(i, y) == v && state->getPixel(i, y + h - 1) == v;
+  }
+  for (int j = y + 1; uniform && j < y + h - 1; j++) {
+    uniform = state->getPixel(x, j) == v && state->getPixel(x + w - 1, j) == v;
+  }
+  if (uniform) {
+    for (int j = y + 1; j < y + h - 1; j++) {
+      for (int i = x + 1; i < x + w - 1; ) {
+        int index = state->getPixelIndex(i, j);
+        int n = std::min(state->getRunLength(i), x + w - 1 - i);
+        for (int k = 0; k < n; k++) if (!state->isSetAt(index + k)) state->setPixelAt(index + k, v);
+        i += n;
+      }
+    }
+    return true;
+  }
+  // halves share the dividing line, borders already set are not recomputed
+  if (w >= h) {
+    int m = x + w / 2;
+    return subdivideRect(state, x, y, m - x + 1, h, row) && subdivideRect(state, m, y, x + w - m, h, row);
+  } else {
+    int m = y + h / 2;
+    return subdivideRect(state, x, y, w, m - y + 1, row) && subdivideRect(state, x, m, w, y + h - m, row);
+  }
+}
+
 /*
 class Quad_IIM : public Algorithm {
   int depth;
@@ -235,6 +410,9 @@ Algorithm *makeAlgorithm(const char *name) {
   }
   if (n == "linear") return new Linear();
   else if (n == "refine") return new Refine();
+  else if (n == "perturbation") return new Perturbation();
+  else if (n == "mariani-silver") return new MarianiSilver();
+
   else return new Linear();
 }
 /*
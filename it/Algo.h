@@ -14,6 +14,7 @@
 
 *************************************************************************/
 #pragma once
+#include <functional>
 
 class Function;
 class State;
@@ -32,10 +33,20 @@ public:
   Algorithm(const char *name) { this->name = name; }
   virtual ~Algorithm() { }
   void start(Function *f, State *state);
-  void piece(int part, int total, Function *f);
+  virtual void piece(int part, int total, Function *f);
   void stop(); // sets running=false, stop as soon as interruptible
+  // Per-frame setup shared by all rows, called once after start()
+  virtual void prepare(Function *f) { }
+  // Pixels x..x+n-1 of row y into out; xs[i] = state->X(x+i)
+  virtual void computeRow(Function *f, const double *xs, int x, int y, int n, double *out);
+
 };
 
 Algorithm *makeAlgorithm(const char *name);
 
+// Mariani-Silver: compute the border of the rectangle; fill the inside if
+// the border is uniform, else split it in two and recurse. row(x, y, n)
+// computes and sets the unset pixels x..x+n-1 of row y, false to abort.
+bool subdivideRect(State *state, int x, int y, int w, int h, const std::function<bool(int, int, int)> &row);
+
 /******************************* EOF *************************************/
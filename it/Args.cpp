@@ -91,6 +91,12 @@ int ItArg::toInt() {
   else return 0;
 }
 
+complex ItArg::toComplex() {
+  if (type == T_complex)
+    return *(complex *)addr;
+  else return complex(0, 0);
+}
+
 /***************************** Args class *******************************/
 
 ItArgs::ItArgs() {
@@ -171,5 +177,12 @@ int ItArgs::getInt(const char *name) {
   if (arg) return arg->toInt();
   return 0;
 }
+
+complex ItArgs::getComplex(const char *name) {
+  ItArg *arg = getArg(name);
+  if (arg) return arg->toComplex();
+  return complex(0, 0);
+}
+
   
 /******************************* EOF ************************************/
@@ -8,6 +8,7 @@ enum ArgType { T_int, T_float, T_double, T_complex, T_String };
 #include <unordered_map>
 #include <vector>
 #define String std::string
+class complex;
 class ItArg { 
 private:
   String _name;		/* name, may be different from var name */
@@ -28,6 +29,7 @@ public:
   String& toString();		/* value=*addr; return value */
   double toDouble();
   int toInt();
+  complex toComplex();
   void setValue();		/* set value from *addr */
   void parse(const char *s);	/* set addr from s (don't touch value) */
   void apply(); // set addr from value
@@ -56,6 +58,8 @@ public:
   void restoreValues();
   double getDouble(const char *name);
   int getInt(const char *name);
+  complex getComplex(const char *name);
+
   void copy(const ItArgs &args);
   //void store(Hash &externalhash);
   //void restore(Hash &externalhash);
@@ -404,6 +404,8 @@ Colormap::Colormap(int (*f)(double)) {
     origr[i] = origg[i] = origb[i] = (unsigned char)i;
   }
   colorfun = f;
+  table.resize(LUTSIZE);
+  for (i = 0; i < LUTSIZE; i++) table[i] = (uint)colorfun((double)i / (LUTSIZE - 1));
 }
 
 Colormap::~Colormap() {
@@ -476,6 +478,7 @@ void Colormap::setColor(unsigned char index, unsigned char red, unsigned char gr
   g_[index] = green;
   b_[index] = blue;
   colorfun = nullptr; // want to use only particular colors
+  table.clear();
 }
 
 void Colormap::restore() {
@@ -499,7 +502,7 @@ uint Colormap::getColor(double x) {
   u.d = x;
   if ((u.i & 0x8000000000000000ULL) == 0) { // regular values in [0, 1]
     if (colorfun) {
-      return colorfun(x);
+      return table[(int)(clamp(x) * (LUTSIZE - 1) + 0.5)];
     } else {
       int index = clamp((int)(x * 255));
       int r = (int)r_[index];
@@ -515,5 +518,24 @@ uint Colormap::getColor(double x) {
   }
 }
 
+// RGB as -(1 + 0xRRGGBB)
+uint Colormap::getColorFloat(float x) {
+  if (x >= 0.0f) return getColor((double)x);
+  return 0xFF000000u | ((uint)(-x) - 1);
+}
+
+// 15-bit value, or 0x8000 | RGB555
+uint Colormap::getColor16(uint16_t q) {
+  if ((q & 0x8000) == 0) return getColor(q / 32767.0);
+  uint r = (q >> 10) & 31, g = (q >> 5) & 31, b = q & 31;
+  return 0xFF000000u | (((r << 3) | (r >> 2)) << 16) | (((g << 3) | (g >> 2)) << 8) | ((b << 3) | (b >> 2));
+}
+
+// 24-bit value with alpha 0, or 0xffRRGGBB
+uint Colormap::getColor32(uint32_t p) {
+  if (p >> 24) return p;
+  return getColor((p & 0xFFFFFFu) / 16777215.0);
+}
+
 /******************************** EOF ****************************************/
 
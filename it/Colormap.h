@@ -19,6 +19,7 @@
 #define COLORMAP_H
 #include <vector>
 #include <string>
+#include <stdint.h>
 
 class Colormap {
 public:
@@ -40,10 +41,16 @@ public:
   void load(const std::string &filename);
   void save(const char *file);
   uint getColor(double x); // x in [0, 1]
+  // The compact pixel formats of State (see PixelFormat)
+  uint getColorFloat(float x);
+  uint getColor16(uint16_t q);
+  uint getColor32(uint32_t p);
+
 
 private:
+  enum { LUTSIZE = 4096 };
   int (*colorfun)(double t);
-  std::vector<uint> table;
+  std::vector<uint> table; // colorfun baked at LUTSIZE points in [0, 1]
 };
 
 #endif /* Colormap_H */
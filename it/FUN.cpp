@@ -19,10 +19,10 @@ CLASS(SampleQuadratic, "Quadratic function") { public:
     setDefaultRangeDynamicalSpace(-2, 2, -2, 2);
   }
 
-  //Function *copy() {
-  //  Quadratic *f = new Quadratic(name, "", pspace);
-  //  return f->copyArgsFrom(this);
-  //}
+  Function *copy() {
+    SampleQuadratic *f = new SampleQuadratic(name, "", pspace);
+    return f->copyArgsFrom(this);
+  }
 
   double iterate_(double x, double y) {
     int i;
@@ -34,14 +34,45 @@ CLASS(SampleQuadratic, "Quadratic function") { public:
       z = complex(x, y);
       c = C;
     }
+    Cycle cycle(z, CYCLE_TOLERANCE); // interior points settle on a cycle
     for (i = 0; i < depth; i++) {
       z = z * z + c;
       if (norm(z) > escape * escape) break;
+      if (cycle.check(z)) return 1.0;
     }
     //debug("%d %d", i, depth);
     return (double)i / depth;
   }
 
+  // Same as iterate_, but IT_SIMD_LANES pixels at a time
+  void iterateRow(const double *xs, double y, double *out, int n) {
+    const int L = IT_SIMD_LANES;
+    int k = 0;
+    for (; k + L <= n; k += L) {
+      complexn z, c;
+      if (PARAMETER_SPACE) {
+        z = complexn(0, 0);
+        c = complexn(xs + k, y);
+      } else {
+        z = complexn(xs + k, y);
+        c = complexn(C);
+      }
+      doublen count(0.0);
+      maskn active(true);
+      cyclen cycle(z, CYCLE_TOLERANCE);
+      for (int i = 0; i < depth && any(active); i++) {
+        z = z * z + c;
+        active = active & (norm(z) <= escape * escape);
+        count = count + select(active, 1.0, 0.0);
+        maskn settled = active & cycle.check(z);
+        count = select(settled, doublen((double)depth), count);
+        active = active & !settled;
+      }
+      (count / (double)depth).store(out + k);
+    }
+    for (; k < n; k++) out[k] = iterate_(xs[k], y);
+  }
+
   // Forward orbit: assign f(x) to x
   void orbit(complex &x) {
     x =  x * x + C;
@@ -64,6 +95,61 @@ CLASS(SampleQuadratic, "Quadratic function") { public:
   }
 };
 
+CLASS(SampleDeepQuadratic, "Quadratic function, deep zoom") { public:
+  // Declare your parameters and working variables here
+  complex C;
+  int depth;
+  double escape;
+
+  SampleDeepQuadratic(String name, String label, int pspace) : Function(name, label, pspace) {
+    // The "perturbation" algorithm renders z*z+C from a high precision
+    // reference orbit and needs exactly these three parameters
+    PARAM(C, "C", complex, complex(0, 0), complex(-1,0));
+    PARAM(depth, "depth", int, 1000, 1000);
+    PARAM(escape, "escape", double, 1000, 1000);
+    algorithm = "perturbation";
+    // Set the default range for both spaces
+    setDefaultRangeParameterSpace(-2.2, 1.4, -1.8, 1.8);
+    setDefaultRangeDynamicalSpace(-2, 2, -2, 2);
+  }
+
+  Function *copy() {
+    SampleDeepQuadratic *f = new SampleDeepQuadratic(name, "", pspace);
+    return f->copyArgsFrom(this);
+  }
+
+  // Plain double iteration. The perturbation algorithm computes every pixel,
+  // previews included, so this only runs if algorithm is not set above
+  double iterate_(double x, double y) {
+    int i;
+    complex z, c;
+    if (PARAMETER_SPACE) {
+      z = complex(0, 0);
+      c.set(x, y);
+    } else {
+      z = complex(x, y);
+      c = C;
+    }
+    Cycle cycle(z, CYCLE_TOLERANCE);
+    for (i = 0; i < depth; i++) {
+      z = z * z + c;
+      if (norm(z) > escape * escape) break;
+      if (cycle.check(z)) return 1.0;
+    }
+    return (double)i / depth;
+  }
+
+  // Forward orbit: assign f(x) to x
+  void orbit(complex &x) {
+    x =  x * x + C;
+  }
+
+  // Set the parameter in dynamical space
+  void setParameter(double x, double y) {
+    C.set(x, y);
+  }
+};
+
 CLASS(SampleMilnor, "Milnor function") { public:
   // Declare your parameters and working variables here
   complex a;
@@ -96,10 +182,12 @@ CLASS(SampleMilnor, "Milnor function") { public:
       a.set(1, 0); /// Nuria?
       z = complex(x, y);
     }
+    Cycle cycle(z, CYCLE_TOLERANCE);
     for (i = 0; i < depth; i++) {
       z = a * z * z * (z - 1);
       if (norm(z) < 1/(escape*escape)) return 0.9;
       if (norm(z) > escape * escape) break;
+      if (cycle.check(z)) return 1.0;
     }
     return (double)i/depth;
   }
@@ -143,10 +231,12 @@ CLASS(SampleNewton, "Newton's Method") { public:
       a.set(0.5, 0.866025);
       z = complex(x, y);
     }
+    Cycle cycle(z, CYCLE_TOLERANCE); // attracting cycles other than the roots
     for (i = 0; i < depth; i++) {
       z = z*z*(1+a-2*z)/(-a+2*z+2*a*z-3*z*z);
       if (norm(z-a)<(1/escape)||norm(z-1)<(1/escape)||norm(z)<(1/escape))
         return (double)i/depth;
+      if (cycle.check(z)) return 1.0;
     }
   //  if (norm(z-a)<(1/escape)) return (byte) (0);
   //  if (norm(z-1)<(1/escape)) return (byte) (1);
@@ -193,9 +283,11 @@ CLASS(SampleCentExponential, "CentExponential: a (exp(z)-1)") { public:
     } else {
       z = complex(x, y);
     }
+    Cycle cycle(z, CYCLE_TOLERANCE);
     for (i = 0; i < depth; i++) {
       z = a * (exp(z) - 1);
       if ((z.real() > escape))  return (double)i/depth;
+      if (cycle.check(z)) return 1.0;
     }
     return 1.0;
   }
@@ -236,6 +328,7 @@ CLASS(SampleTangent, "tangent: a tan(z)") { public:
     ARG(depth, "depth", int, 200, ANY);
     ARG(escape, "bound", double, 1000, ANY);
     PARAM(pixfactor, "pixfactor", double, 1,1);
+    subdivide = PARAMETER_SPACE; // the Julia set is isolated pixels, missed by uniform borders
     defaults();
   }
   void defaults() {
@@ -265,9 +358,11 @@ CLASS(SampleTangent, "tangent: a tan(z)") { public:
       z = complex(x, y);
     }
     if (PARAMETER_SPACE) {
+      Cycle cycle(z, CYCLE_TOLERANCE); // settled: go on to the period below
       for(i = 0; i < depth; i++) {
         z = -ii* a * (exp(ii*z)-exp(-ii*z))/(exp(ii*z)+exp(-ii*z));
         if(norm(z) > escape*escape) break;
+        if (cycle.check(z)) { i = depth; break; }
       }
       if (i < depth - 1) return (byte)(255*i/depth);
       w = z;
@@ -322,6 +417,9 @@ Function *createBuiltinFunction(const std::string &name) {
   if (name == "Sample Quadratic") {
     p = new SampleQuadratic("a", "b", 1);
     d = new SampleQuadratic("a", "a", 0);
+  } else if (name == "Sample Deep Quadratic") {
+    p = new SampleDeepQuadratic("a", "b", 1);
+    d = new SampleDeepQuadratic("a", "a", 0);
   } else if (name == "Sample Milnor") {
     p = new SampleMilnor("a", "b", 1);
     d = new SampleMilnor("a", "a", 0);
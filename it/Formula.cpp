@@ -0,0 +1,628 @@
+#include "Formula.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <tuple>
+
+/******************************* Evaluation *******************************/
+
+static inline complex real_(double x) { return complex(x, 0.0); }
+template <int N> static inline complexv<N> real_(const doublev<N> &x) { return complexv<N>(x, doublev<N>(0.0)); }
+
+// One instruction, on complex or on complexv<N>; also folds constants
+template <class C> static inline C eval(const Formula::Ins &in, const C *r) {
+  const C &a = r[in.a], &b = r[in.b];
+  switch (in.op) {
+  case Formula::F_NEG: return -a;
+  case Formula::F_ADD: return a + b;
+  case Formula::F_SUB: return a - b;
+  case Formula::F_MUL: return a * b;
+  case Formula::F_DIV: return a / b;
+  case Formula::F_POWI: return pow(a, in.n);
+  case Formula::F_POWR: return pow(a, in.k.re);
+  case Formula::F_POW: return pow(a, b);
+  case Formula::F_EXP: return exp(a);
+  case Formula::F_LOG: return log(a);
+  case Formula::F_SQRT: return sqrt(a);
+  case Formula::F_SIN: return sin(a);
+  case Formula::F_COS: return cos(a);
+  case Formula::F_CONJ: return conj(a);
+  case Formula::F_ABS: return real_(abs(a));
+  case Formula::F_NORM: return real_(norm(a));
+  case Formula::F_RE: return real_(real(a));
+  case Formula::F_IM: return real_(imag(a));
+  case Formula::F_ARG: return real_(arg(a));
+  default: return C(in.k); // F_CONST
+  }
+}
+
+/******************************** Compiler ********************************/
+
+namespace {
+
+// Registers are assigned once (SSA). Instructions that do not depend on z
+// go to setup, the others to loop; equal instructions are shared and
+// constant ones folded.
+class Compiler {
+public:
+  Formula &f;
+  std::string error;
+  Compiler(Formula &formula) : f(formula) {
+    f.nregs = 0;
+    names["z"] = def(Formula::F_Z, true);
+    names["c"] = def(Formula::F_C, false);
+  }
+  bool failed() { return !error.empty(); }
+  void fail(int lineno, int column, const std::string &msg) {
+    if (failed()) return;
+    char buf[64];
+    snprintf(buf, sizeof(buf), "formula:%d:%d: error: ", lineno, column);
+    error = buf + msg;
+  }
+  void addParam(const std::string &name, ArgType type, const std::string &p, const std::string &d) {
+    f.params.push_back({ name, type, p, d });
+  }
+  void bindParams() {
+    for (size_t k = 0; k < f.params.size(); k++) {
+      int r = def(Formula::F_PARAM, false);
+      defs[r].n = (int)k;
+      names[f.params[k].name] = r;
+    }
+  }
+  bool statement(const char *line, int lineno);
+  void finish();
+private:
+  typedef std::tuple<int, int, int, int, double, double> Key;
+  enum { UNARY = -2 };
+  std::vector<Formula::Ins> defs;  // per register
+  std::vector<bool> variant;       // per register: depends on z
+  std::map<Key, int> cse;
+  std::map<std::string, int> names;
+  const char *s, *line;
+  int lineno;
+  int def(Formula::Op op, bool var) {
+    int r = f.nregs++;
+    defs.push_back({ op, r, r, r, 0, complex(0, 0) });
+    variant.push_back(var);
+    return r;
+  }
+  int emit(Formula::Op op, int a, int b = UNARY, int n = 0, complex k = complex(0, 0));
+  int constant(complex k) { return emit(Formula::F_CONST, 0, 0, 0, k); }
+  bool isConstant(int r, complex *k = nullptr) {
+    if (r < 0 || defs[r].op != Formula::F_CONST) return false;
+    if (k) *k = defs[r].k;
+    return true;
+  }
+  int column() { return (int)(s - line) + 1; }
+  int err(const std::string &msg) { fail(lineno, column(), msg); return -1; }
+  void space() { while (*s == ' ' || *s == '\t') s++; }
+  bool accept(char ch) { space(); if (*s != ch) return false; s++; return true; }
+  std::string ident() {
+    const char *p = s;
+    while (isalnum((unsigned char)*s) || *s == '_') s++;
+    return std::string(p, s - p);
+  }
+  int expr();
+  int term();
+  int unary();
+  int power(int base, int exponent);
+  int primary();
+  int call(const std::string &name, int a);
+};
+
+int Compiler::emit(Formula::Op op, int a, int b, int n, complex k) {
+  if (a < 0 || b == -1) return -1; // after an error
+  if (b == UNARY) b = a;
+  if ((op == Formula::F_ADD || op == Formula::F_MUL) && a > b) std::swap(a, b);
+  Key key(op, a, b, n, k.re, k.im);
+  auto found = cse.find(key);
+  if (found != cse.end()) return found->second;
+  Formula::Ins in = { op, 0, a, b, n, k };
+  complex ka, kb;
+  int r;
+  if (op != Formula::F_CONST && isConstant(a, &ka) && isConstant(b, &kb)) {
+    complex regs[2] = { ka, kb };
+    Formula::Ins folded = in;
+    folded.a = 0;
+    folded.b = a == b ? 0 : 1;
+    r = constant(eval(folded, regs));
+  } else {
+    r = def(op, op != Formula::F_CONST && (variant[a] || variant[b]));
+    in.dst = r;
+    defs[r] = in;
+    if (op == Formula::F_CONST) in.a = in.b = r;
+    (variant[r] ? f.loop : f.setup).push_back(in);
+  }
+  cse[key] = r;
+  return r;
+}
+
+int Compiler::expr() {
+  int r = term();
+  for (;;) {
+    complex k;
+    if (accept('+')) {
+      int t = term();
+      if (isConstant(t, &k) && k == complex(0, 0)) continue;
+      r = emit(Formula::F_ADD, r, t);
+    } else if (accept('-')) {
+      int t = term();
+      if (isConstant(t, &k) && k == complex(0, 0)) continue;
+      r = emit(Formula::F_SUB, r, t);
+    } else {
+      return r;
+    }
+  }
+}
+
+int Compiler::term() {
+  int r = unary();
+  for (;;) {
+    complex k;
+    if (accept('*')) {
+      int t = unary();
+      if (isConstant(t, &k) && k == complex(1, 0)) continue;
+      r = emit(Formula::F_MUL, r, t);
+    } else if (accept('/')) {
+      int t = unary();
+      if (isConstant(t, &k) && k == complex(1, 0)) continue;
+      r = emit(Formula::F_DIV, r, t);
+    } else {
+      return r;
+    }
+  }
+}
+
+// -z^2 is -(z^2), and z^-1 and a^b^c (= a^(b^c)) are allowed
+int Compiler::unary() {
+  if (accept('-')) return emit(Formula::F_NEG, unary());
+  if (accept('+')) return unary();
+  int r = primary();
+  if (accept('^')) r = power(r, unary());
+  return r;
+}
+
+// Integer powers by repeated squaring, real ones without a complex log
+int Compiler::power(int base, int exponent) {
+  complex k;
+  if (base < 0 || exponent < 0) return -1;
+  if (!isConstant(exponent, &k)) return emit(Formula::F_POW, base, exponent);
+  if (k.im != 0) return emit(Formula::F_POW, base, exponent);
+  if (k.re == floor(k.re) && fabs(k.re) <= 64) {
+    int n = (int)k.re;
+    if (n == 0) return constant(complex(1, 0));
+    if (n == 1) return base;
+    if (n == 2) return emit(Formula::F_MUL, base, base);
+    return emit(Formula::F_POWI, base, UNARY, n);
+  }
+  return emit(Formula::F_POWR, base, UNARY, 0, k);
+}
+
+int Compiler::primary() {
+  space();
+  if (isdigit((unsigned char)*s) || (*s == '.' && isdigit((unsigned char)s[1]))) {
+    char *end;
+    double x = strtod(s, &end);
+    s = end;
+    if (*s == 'i' && !isalnum((unsigned char)s[1]) && s[1] != '_') { // 2i
+      s++;
+      return constant(complex(0, x));
+    }
+    return constant(complex(x, 0));
+  }
+  if (isalpha((unsigned char)*s) || *s == '_') {
+    const char *at = s;
+    std::string name = ident();
+    if (accept('(')) {
+      int a = expr();
+      if (a < 0) return -1;
+      if (!accept(')')) return err("expected ')'");
+      int r = call(name, a);
+      if (r < 0 && !failed()) { s = at; return err("unknown function '" + name + "'"); }
+      return r;
+    }
+    if (name == "i") return constant(complex(0, 1));
+    if (name == "pi") return constant(complex(3.14159265358979323846, 0));
+    auto found = names.find(name);
+    if (found == names.end()) { s = at; return err("unknown name '" + name + "'"); }
+    return found->second;
+  }
+  if (accept('(')) {
+    int r = expr();
+    if (r >= 0 && !accept(')')) return err("expected ')'");
+    return r;
+  }
+  return err(*s ? "expected a value" : "unexpected end of line");
+}
+
+// Functions without an instruction of their own are expanded
+int Compiler::call(const std::string &name, int a) {
+  static const std::map<std::string, Formula::Op> ops = {
+    { "exp", Formula::F_EXP }, { "log", Formula::F_LOG }, { "sqrt", Formula::F_SQRT },
+    { "sin", Formula::F_SIN }, { "cos", Formula::F_COS }, { "conj", Formula::F_CONJ },
+    { "abs", Formula::F_ABS }, { "norm", Formula::F_NORM }, { "re", Formula::F_RE },
+    { "im", Formula::F_IM }, { "arg", Formula::F_ARG }
+  };
+  auto found = ops.find(name);
+  if (found != ops.end()) return emit(found->second, a);
+  if (name == "tan") return emit(Formula::F_DIV, emit(Formula::F_SIN, a), emit(Formula::F_COS, a));
+  if (name == "sinh" || name == "cosh" || name == "tanh") {
+    int e = emit(Formula::F_EXP, a);
+    int em = emit(Formula::F_EXP, emit(Formula::F_NEG, a));
+    int sinh2 = emit(Formula::F_SUB, e, em), cosh2 = emit(Formula::F_ADD, e, em);
+    if (name == "tanh") return emit(Formula::F_DIV, sinh2, cosh2);
+    return emit(Formula::F_MUL, name == "sinh" ? sinh2 : cosh2, constant(complex(0.5, 0)));
+  }
+  return -1;
+}
+
+static bool isReserved(const std::string &name) {
+  static const char *reserved[] = {
+    "c", "i", "pi", "z0", "param", "range", "prange", "drange",
+    "exp", "log", "sqrt", "sin", "cos", "tan", "sinh", "cosh", "tanh",
+    "conj", "abs", "norm", "re", "im", "arg", nullptr
+  };
+  for (const char **r = reserved; *r; r++) if (name == *r) return true;
+  return false;
+}
+
+// name = expression
+bool Compiler::statement(const char *text, int no) {
+  s = line = text;
+  lineno = no;
+  space();
+  const char *at = s;
+  std::string name = ident();
+  if (name.empty() || isdigit((unsigned char)name[0])) { s = at; err("expected a name"); return false; }
+  bool isParam = false;
+  for (const Formula::Param &p: f.params) isParam |= p.name == name;
+  if (name != "z0" && (isReserved(name) || isParam)) { s = at; err("cannot assign to '" + name + "'"); return false; }
+  if (!accept('=')) { err("expected '='"); return false; }
+  int r = expr();
+  if (r < 0) return false;
+  space();
+  if (*s) { err("expected an operator"); return false; }
+  if (name == "z0") {
+    if (f.startreg >= 0) { s = at; err("z0 is already set"); return false; }
+    if (variant[r]) { s = at; err("z0 cannot depend on z"); return false; }
+    f.startreg = r;
+  } else {
+    names[name] = r;
+  }
+  if (f.nregs > FORMULA_REGISTERS) { s = at; err("too long"); return false; }
+  return true;
+}
+
+// The next z, and only the instructions it (or z0) needs
+void Compiler::finish() {
+  f.zreg = names["z"];
+  std::vector<bool> live(f.nregs, false);
+  live[f.zreg] = true;
+  if (f.startreg >= 0) live[f.startreg] = true;
+  for (std::vector<Formula::Ins> *list: { &f.loop, &f.setup }) {
+    std::vector<Formula::Ins> kept;
+    for (auto in = list->rbegin(); in != list->rend(); ++in) {
+      if (!live[in->dst]) continue;
+      live[in->a] = live[in->b] = true;
+      kept.push_back(*in);
+    }
+    list->assign(kept.rbegin(), kept.rend());
+  }
+}
+
+} // namespace
+
+/******************************** Formula *********************************/
+
+static std::string trim(const std::string &str) {
+  size_t b = str.find_first_not_of(" \t\r"), e = str.find_last_not_of(" \t\r");
+  return b == std::string::npos ? "" : str.substr(b, e - b + 1);
+}
+
+bool Formula::isFormula(const std::string &text) {
+  return trim(text.substr(0, text.find('\n'))).compare(0, 8, "#formula") == 0;
+}
+
+// A number, or for complex "x,y"; normalized as ItArg::setValue would
+static bool parseValue(const std::string &word, ArgType type, std::string &value) {
+  const char *p = word.c_str();
+  char *end;
+  double re = strtod(p, &end), im = 0;
+  if (end == p) return false;
+  if (type == T_complex && *end == ',') {
+    p = end + 1;
+    im = strtod(p, &end);
+    if (end == p) return false;
+  }
+  if (*end) return false;
+  char buf[80];
+  if (type == T_int) {
+    if (re != floor(re)) return false;
+    snprintf(buf, sizeof(buf), "%d", (int)re);
+  } else if (type == T_double) {
+    snprintf(buf, sizeof(buf), "%.17g", re);
+  } else {
+    snprintf(buf, sizeof(buf), "%.17g,%.17g", re, im);
+  }
+  value = buf;
+  return true;
+}
+
+Formula *Formula::compile(const std::string &text, std::string &error) {
+  Formula *f = new Formula();
+  Compiler compiler(*f);
+  f->startreg = -1;
+  f->cparam = f->depthparam = f->escapeparam = f->convergeparam = -1;
+  const double pr[4] = { -2.2, 1.4, -1.8, 1.8 }, dr[4] = { -2, 2, -2, 2 };
+  std::copy(pr, pr + 4, f->prange);
+  std::copy(dr, dr + 4, f->drange);
+
+  // Without comments; declarations first, so parameters can be used anywhere
+  std::vector<std::string> lines;
+  size_t pos = 0;
+  while (pos <= text.size()) {
+    size_t end = text.find('\n', pos);
+    if (end == std::string::npos) end = text.size();
+    std::string line = text.substr(pos, end - pos);
+    size_t comment = std::min(line.find('#'), line.find("//"));
+    if (comment != std::string::npos) line.resize(comment);
+    std::replace(line.begin(), line.end(), '\t', ' ');
+    lines.push_back(line);
+    pos = end + 1;
+  }
+  std::vector<bool> declaration(lines.size(), false);
+  std::vector<int> declared; // line of each parameter
+  for (size_t l = 0; l < lines.size() && !compiler.failed(); l++) {
+    std::vector<std::pair<std::string, int>> words; // and their columns
+    const std::string &line = lines[l];
+    for (size_t b = line.find_first_not_of(' '); b != std::string::npos; ) {
+      size_t e = std::min(line.find(' ', b), line.size());
+      words.push_back({ line.substr(b, e - b), (int)b + 1 });
+      b = line.find_first_not_of(' ', e);
+    }
+    if (words.empty()) { declaration[l] = true; continue; }
+    int no = (int)l + 1;
+    const std::string &kw = words[0].first;
+    if (kw == "param") {
+      declaration[l] = true;
+      if (words.size() < 4 || words.size() > 5) { compiler.fail(no, 1, "expected 'param NAME complex|double|int VALUE [DYNAMICAL-VALUE]'"); break; }
+      const std::string &name = words[1].first;
+      bool valid = isalpha((unsigned char)name[0]) || name[0] == '_';
+      for (char ch: name) valid &= isalnum((unsigned char)ch) || ch == '_';
+      if (!valid || isReserved(name) || name == "z") { compiler.fail(no, words[1].second, "invalid parameter name '" + name + "'"); break; }
+      for (const Param &p: f->params) {
+        if (p.name == name) compiler.fail(no, words[1].second, "'" + name + "' is already declared");
+      }
+      const std::string &t = words[2].first;
+      ArgType type = t == "complex" ? T_complex : t == "double" ? T_double : t == "int" ? T_int : T_String;
+      if (type == T_String) { compiler.fail(no, words[2].second, "unknown type '" + t + "'"); break; }
+      std::string vp, vd;
+      if (!parseValue(words[3].first, type, vp)) { compiler.fail(no, words[3].second, "invalid " + t + " '" + words[3].first + "'"); break; }
+      vd = vp;
+      if (words.size() == 5 && !parseValue(words[4].first, type, vd)) { compiler.fail(no, words[4].second, "invalid " + t + " '" + words[4].first + "'"); break; }
+      compiler.addParam(name, type, vp, vd);
+      declared.push_back(no);
+    } else if (kw == "range" || kw == "prange" || kw == "drange") {
+      declaration[l] = true;
+      double v[4];
+      if (words.size() != 5) { compiler.fail(no, 1, "expected '" + kw + " XMIN XMAX YMIN YMAX'"); break; }
+      for (int k = 0; k < 4; k++) {
+        char *end;
+        v[k] = strtod(words[k + 1].first.c_str(), &end);
+        if (*end || end == words[k + 1].first.c_str()) compiler.fail(no, words[k + 1].second, "invalid number '" + words[k + 1].first + "'");
+      }
+      if (v[0] >= v[1] || v[2] >= v[3]) compiler.fail(no, words[1].second, "empty range");
+      if (kw != "drange") std::copy(v, v + 4, f->prange);
+      if (kw != "prange") std::copy(v, v + 4, f->drange);
+    }
+  }
+
+  // The parameters every formula has, unless declared
+  struct Builtin { const char *name; ArgType type; const char *p, *d; int *index; };
+  Builtin builtins[] = {
+    { "C", T_complex, "0,0", "-1,0", &f->cparam },
+    { "depth", T_int, "150", "150", &f->depthparam },
+    { "escape", T_double, "1000", "1000", &f->escapeparam },
+    { "converge", T_double, "0", "0", &f->convergeparam }
+  };
+  for (Builtin &b: builtins) {
+    for (size_t k = 0; k < f->params.size(); k++) {
+      if (f->params[k].name != b.name) continue;
+      *b.index = (int)k;
+      if (f->params[k].type != b.type) {
+        static const char *types[] = { "int", "float", "double", "complex" };
+        compiler.fail(declared[k], 1, std::string(b.name) + " must be " + types[b.type]);
+      }
+    }
+    if (*b.index >= 0) continue;
+    *b.index = (int)f->params.size();
+    if (b.name[0] == 'C') { // first in the list, as in the samples
+      for (int *index: { &f->depthparam, &f->escapeparam, &f->convergeparam }) if (*index >= 0) (*index)++;
+      f->params.insert(f->params.begin(), { b.name, b.type, b.p, b.d });
+      declared.insert(declared.begin(), 1);
+      *b.index = 0;
+    } else {
+      compiler.addParam(b.name, b.type, b.p, b.d);
+      declared.push_back(1);
+    }
+  }
+  if (f->params.size() + 2 > FORMULA_REGISTERS) compiler.fail(1, 1, "too many parameters");
+
+  if (!compiler.failed()) compiler.bindParams();
+  bool assigned = false;
+  for (size_t l = 0; l < lines.size() && !compiler.failed(); l++) {
+    if (declaration[l]) continue;
+    if (!compiler.statement(lines[l].c_str(), (int)l + 1)) break;
+    std::string name = trim(lines[l].substr(0, lines[l].find('=')));
+    assigned |= name == "z";
+  }
+  if (!assigned) compiler.fail(1, 1, "no iteration: assign z, e.g. z = z^2 + c");
+  if (compiler.failed()) {
+    error = compiler.error;
+    delete f;
+    return nullptr;
+  }
+  compiler.finish();
+  return f;
+}
+
+const char *Formula::example() {
+  return
+    "#formula\n"
+    "# z is iterated, from z0 in parameter space and from the pixel in\n"
+    "# dynamical space. c is the pixel in parameter space and the parameter\n"
+    "# C in dynamical space. Iteration stops when |z| > escape, when z moves\n"
+    "# less than converge (if not 0), or on a cycle, after at most depth steps.\n"
+    "#\n"
+    "#   param NAME complex|double|int VALUE [DYNAMICAL-SPACE-VALUE]\n"
+    "#   prange|drange|range XMIN XMAX YMIN YMAX\n"
+    "#   name = expression\n"
+    "#\n"
+    "# Operators + - * / ^, constants i and pi, and the functions exp log sqrt\n"
+    "# sin cos tan sinh cosh tanh conj abs norm re im arg.\n"
+    "\n"
+    "param a complex 0,0\n"
+    "prange -2.2 1.4 -1.8 1.8\n"
+    "drange -2 2 -2 2\n"
+    "\n"
+    "z0 = 0\n"
+    "z = z^2 + a*z^3 + c\n";
+}
+
+/***************************** FormulaFunction ****************************/
+
+FormulaFunction::FormulaFunction(std::shared_ptr<const Formula> formula_, int pspace)
+  : Function("formula", "formula", pspace), formula(formula_) {
+  values.resize(formula->params.size());
+  for (size_t k = 0; k < values.size(); k++) {
+    const Formula::Param &p = formula->params[k];
+    void *addr = p.type == T_complex ? (void *)&values[k].z : p.type == T_double ? (void *)&values[k].d : (void *)&values[k].i;
+    ItArg *arg = new ItArg(p.name.c_str(), p.type, addr, "", 0);
+    arg->value_p = p.valuep;
+    arg->value_d = p.valued;
+    arg->parse(pspace == 1 ? p.valuep.c_str() : p.valued.c_str());
+    args.addArg(p.name.c_str(), arg);
+  }
+  const double *pr = formula->prange, *dr = formula->drange;
+  setDefaultRangeParameterSpace(pr[0], pr[1], pr[2], pr[3]);
+  setDefaultRangeDynamicalSpace(dr[0], dr[1], dr[2], dr[3]);
+}
+
+Function *FormulaFunction::copy() {
+  FormulaFunction *f = new FormulaFunction(formula, pspace);
+  return f->copyArgsFrom(this);
+}
+
+complex FormulaFunction::param(int k) {
+  switch (formula->params[k].type) {
+  case T_complex: return values[k].z;
+  case T_double: return complex(values[k].d, 0);
+  default: return complex(values[k].i, 0);
+  }
+}
+
+void FormulaFunction::setParameter(double x, double y) {
+  values[formula->cparam].z.set(x, y);
+}
+
+void FormulaFunction::orbit(complex &z) {
+  const Formula &f = *formula;
+  complex r[FORMULA_REGISTERS];
+  for (size_t k = 0; k < values.size(); k++) r[2 + k] = param((int)k);
+  r[0] = z;
+  r[1] = param(f.cparam);
+  for (const Formula::Ins &in: f.setup) r[in.dst] = eval(in, r);
+  for (const Formula::Ins &in: f.loop) r[in.dst] = eval(in, r);
+  z = r[f.zreg];
+}
+
+double FormulaFunction::iterate_(double x, double y) {
+  const Formula &f = *formula;
+  complex r[FORMULA_REGISTERS];
+  for (size_t k = 0; k < values.size(); k++) r[2 + k] = param((int)k);
+  if (PARAMETER_SPACE) {
+    r[0] = complex(0, 0);
+    r[1] = complex(x, y);
+  } else {
+    r[0] = complex(x, y);
+    r[1] = param(f.cparam);
+  }
+  for (const Formula::Ins &in: f.setup) r[in.dst] = eval(in, r);
+  if (PARAMETER_SPACE && f.startreg >= 0) r[0] = r[f.startreg];
+  int depth = std::max(1, values[f.depthparam].i);
+  double escape2 = values[f.escapeparam].d * values[f.escapeparam].d;
+  double converge2 = values[f.convergeparam].d * values[f.convergeparam].d;
+  bool escapes = values[f.escapeparam].d > 0, converges = values[f.convergeparam].d > 0;
+  Cycle cycle(r[0], CYCLE_TOLERANCE);
+  for (int i = 0; i < depth; i++) {
+    for (const Formula::Ins &in: f.loop) r[in.dst] = eval(in, r);
+    complex z = r[f.zreg];
+    if (escapes && !(norm(z) <= escape2)) return (double)i / depth; // also NaN
+    if (converges && !(norm(z - r[0]) >= converge2)) return (double)i / depth;
+    if (cycle.check(z)) return 1.0;
+    r[0] = z;
+  }
+  return 1.0;
+}
+
+// Same as iterate_, for N pixels; finished lanes keep their last z
+template <int N> void FormulaFunction::iterateLanes(const double *xs, double y, double *out) {
+  const Formula &f = *formula;
+  complexv<N> r[FORMULA_REGISTERS];
+  for (size_t k = 0; k < values.size(); k++) r[2 + k] = complexv<N>(param((int)k));
+  if (PARAMETER_SPACE) {
+    r[0] = complexv<N>(0, 0);
+    r[1] = complexv<N>(xs, y);
+  } else {
+    r[0] = complexv<N>(xs, y);
+    r[1] = complexv<N>(param(f.cparam));
+  }
+  for (const Formula::Ins &in: f.setup) r[in.dst] = eval(in, r);
+  if (PARAMETER_SPACE && f.startreg >= 0) r[0] = r[f.startreg];
+  int depth = std::max(1, values[f.depthparam].i); // depth 0 would give 0/0
+  double escape2 = values[f.escapeparam].d * values[f.escapeparam].d;
+  double converge2 = values[f.convergeparam].d * values[f.convergeparam].d;
+  bool escapes = values[f.escapeparam].d > 0, converges = values[f.convergeparam].d > 0;
+  doublev<N> count(0.0);
+  maskv<N> active(true);
+  cyclev<N> cycle(r[0], CYCLE_TOLERANCE);
+  for (int i = 0; i < depth && any(active); i++) {
+    for (const Formula::Ins &in: f.loop) r[in.dst] = eval(in, r);
+    complexv<N> z = r[f.zreg];
+    if (escapes) active = active & (norm(z) <= escape2);
+    if (converges) active = active & (norm(z - r[0]) >= converge2);
+    count = count + select(active, 1.0, 0.0);
+    maskv<N> settled = active & cycle.check(z);
+    count = select(settled, doublev<N>((double)depth), count);
+    active = active & !settled;
+    r[0] = select(active, z, r[0]);
+  }
+  (count / (double)depth).store(out);
+}
+
+void FormulaFunction::iterateRow(const double *xs, double y, double *out, int n) {
+  const int L = FORMULA_LANES;
+  int k = 0;
+  for (; k + L <= n; k += L) iterateLanes<L>(xs + k, y, out + k);
+  if (k == n) return;
+  double x[L], o[L]; // the rest, padded with the last pixel
+  for (int j = 0; j < L; j++) x[j] = xs[std::min(k + j, n - 1)];
+  iterateLanes<L>(x, y, o);
+  for (int j = k; j < n; j++) out[j] = o[j - k];
+}
+
+Function *createFormulaFunction(const std::string &text, std::string &error) {
+  Formula *formula = Formula::compile(text, error);
+  if (formula == nullptr) return nullptr;
+  std::shared_ptr<const Formula> shared(formula);
+  Function *p = new FormulaFunction(shared, 1);
+  Function *d = new FormulaFunction(shared, 0);
+  p->other = d;
+  d->other = p;
+  return p;
+}
+
+/******************************** EOF ***********************************/
@@ -0,0 +1,78 @@
+#pragma once
+#include "Function.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// Functions written as formulas instead of a CLASS: the text is compiled
+// into a small register program in no time, and an interpreter runs it on
+// FORMULA_LANES pixels at once. A formula file starts with "#formula":
+//
+//   #formula
+//   param a complex 0.5,0.5 -0.1,0.65   # value in parameter, dynamical space
+//   z0 = 0                             # start in parameter space
+//   z = z^2 + a*z + c                  # one iteration
+//
+// c is the pixel in parameter space and the parameter C in dynamical space,
+// where z starts at the pixel. Iteration stops when |z| > escape, when z
+// moves less than converge (if > 0), or on a cycle; see Formula::example.
+
+#define FORMULA_LANES IT_SIMD_LANES // pixels per interpreter pass; wider is emulated
+#define FORMULA_REGISTERS 256  // z, c, the parameters and all values
+
+class Formula {
+public:
+  enum Op {
+    F_Z, F_C, F_PARAM, F_CONST,                 // inputs, not executed
+    F_NEG, F_ADD, F_SUB, F_MUL, F_DIV,
+    F_POWI, F_POWR, F_POW,                      // integer, real, complex exponent
+    F_EXP, F_LOG, F_SQRT, F_SIN, F_COS, F_CONJ,
+    F_ABS, F_NORM, F_RE, F_IM, F_ARG            // real results
+  };
+  struct Ins {
+    Op op;
+    int dst, a, b;  // registers
+    int n;          // F_POWI exponent, F_PARAM index
+    complex k;      // F_CONST value, F_POWR exponent
+  };
+  struct Param {
+    std::string name;
+    ArgType type;   // T_complex, T_double or T_int
+    std::string valuep, valued;
+  };
+
+  // nullptr with error "formula:LINE:COLUMN: error: ..." if text is not valid
+  static Formula *compile(const std::string &text, std::string &error);
+  static bool isFormula(const std::string &text); // starts with "#formula"
+  static const char *example();                   // for new formulas
+
+  std::vector<Param> params;      // in register 2 + index
+  std::vector<Ins> setup;         // once per pass: does not depend on z
+  std::vector<Ins> loop;          // every iteration
+  int nregs;
+  int zreg;                       // the next z, after loop
+  int startreg;                   // z0 in parameter space, -1 for 0
+  int cparam, depthparam, escapeparam, convergeparam;
+  double prange[4], drange[4];    // default windows
+};
+
+class FormulaFunction : public Function {
+public:
+  FormulaFunction(std::shared_ptr<const Formula> formula, int pspace);
+  Function *copy();
+  void setParameter(double x, double y);
+  double iterate_(double x, double y);
+  void iterateRow(const double *xs, double y, double *out, int n);
+  void orbit(complex &z);
+private:
+  struct Value { complex z; double d; int i; };
+  std::shared_ptr<const Formula> formula;
+  std::vector<Value> values;      // where the args point, one per parameter
+  complex param(int k);
+  template <int N> void iterateLanes(const double *xs, double y, double *out);
+};
+
+// Both spaces, linked through other like createBuiltinFunction; nullptr on errors
+Function *createFormulaFunction(const std::string &text, std::string &error);
+
+/******************************** EOF ***********************************/
@@ -31,6 +31,8 @@ Function::Function(String name, String label, int _pspace) {
   pspace = _pspace;
   doDebug = false;
   iscopy = false;
+  algorithm = "";
+  subdivide = true;
 }
 
 Function *Function::copy_() {
@@ -50,6 +52,9 @@ Function *Function::copyArgsFrom(Function *f) {
   pspace = f->pspace;
   state = f->state;
   doDebug = f->doDebug;
+  algorithm = f->algorithm;
+  subdivide = f->subdivide;
+
   // assert args.count() == f->args.count()
   for (int i = 0; i < f->args.count(); i++) {
     ItArg *arg = f->args.getArgAt(i);
@@ -133,6 +138,11 @@ double Function::iterate_(double x, double y) {
   return (double)iterate(x, y) / 255.0;
 }
 
+void Function::iterateRow(const double *xs, double y, double *out, int n) {
+  for (int i = 0; i < n; i++)
+    out[i] = iterate_(xs[i], y);
+}
+
 void Function::preview(double px, double py, State *thumbnail) {
   if (thumbnail == 0) return;
   int w = thumbnail->getWidth();
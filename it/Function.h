@@ -18,6 +18,8 @@
 #include "State.h"
 #include "MTRandom.h"
 #include "MTComplex.h"
+#include "MTComplexV.h"
+#include "MTCycle.h"
 #include "debug.h"
 #include <vector>
 #define String std::string
@@ -53,6 +55,8 @@
 #define YMAX (state->ymax)
 #define XRES (state->xres)
 #define YRES (state->yres)
+#define PIXELSIZE (state->pixelSize())
+#define CYCLE_TOLERANCE (1e-3 * PIXELSIZE) /* for Cycle, see MTCycle.h */
 #define SETCOLOR(i,r,g,b) state->setColor(i,r,g,b)
 
 #define CLASS(CN, LBL) class CN : public Function
@@ -109,6 +113,9 @@ public:
   // Return double in [0,1] or a NAN (all 1s first 11 bits) with 0xffRRGGBB
   // Override one or the other
   virtual double iterate_(double x, double y);
+  // Compute a run of pixels on one row: out[i] = iterate_(xs[i], y).
+  // Override to vectorize across pixels; the default calls iterate_.
+  virtual void iterateRow(const double *xs, double y, double *out, int n);
   virtual void orbit(complex &z) {} // compute next point in orbit
   virtual int fixedPoints(complex p[]) { return 0; }
   virtual int preImages(complex z, complex p[]) { return 0; }
@@ -139,6 +146,9 @@ public:
   double defxmin, defxmax, defymin, defymax;
   Random random;      // random generator
   bool iscopy;        // Set true for copies
+  String algorithm;   // "" = iterate_ per pixel, else see makeAlgorithm
+  bool subdivide;     // fill tiles by Mariani-Silver; false if uniform borders can hide detail
+
 public:
   void ClearAnnotations();
   void SetStrokeColor(double r, double g, double b, double opa=255);
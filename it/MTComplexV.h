@@ -0,0 +1,365 @@
+/************************************************************************
+
+    Copyright (C) 1998-2006  Mannes Technology (http://www.mannes-tech.com)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+*************************************************************************/
+
+#ifndef __ITCOMPLEXV__
+#define __ITCOMPLEXV__
+
+#include "MTComplex.h"
+#include <stdint.h>
+
+/*
+ * Packed complex numbers: complexv<N> holds N complex values ("lanes") and
+ * has the same operators and functions as complex. With gcc and clang the
+ * lanes are compiler vector types, so arithmetic becomes SSE2, AVX2,
+ * AVX-512 or NEON code, whatever the build flags allow (-march=native picks
+ * the widest). IT_SIMD_LANES is fixed when the file is compiled; nothing
+ * checks the running CPU, so a build without -march uses 2 lanes (SSE2).
+ * Other compilers get plain loops over the lanes. Functions
+ * like exp or sin are evaluated lane by lane in either case.
+ *
+ * Comparisons of doublev<N> give a maskv<N> with one flag per lane, used
+ * for escape tests:
+ *
+ *   complex4 z(0, 0), c(xs, y);     // 4 pixels xs[0..3] on row y
+ *   double4 n(0.0);
+ *   mask4 active(true);
+ *   for (i = 0; i < depth && any(active); i++) {
+ *     z = z * z + c;
+ *     active = active & (norm(z) <= escape * escape);
+ *     n = n + select(active, 1.0, 0.0);
+ *   }
+ *   (n / depth).store(out);
+ */
+
+#if defined(__AVX512F__)
+#define IT_SIMD_LANES 8
+#elif defined(__AVX__)
+#define IT_SIMD_LANES 4
+#else
+#define IT_SIMD_LANES 2
+#endif
+
+#define LANES(N) for (int k = 0; k < N; k++)
+
+/******************************* Backend **********************************/
+// simd<N>::d holds N doubles, simd<N>::m N lane flags (0 or -1).
+// Both support + - * / (d) or & | ~ (m), comparisons of d give m.
+
+#if defined(__GNUC__) || defined(__clang__)
+#pragma push_macro("__attribute__")
+#undef __attribute__ // MTComplex.h defines it away
+#pragma GCC diagnostic push // restored at the end of the file
+#pragma GCC diagnostic ignored "-Wpsabi" // vector arguments
+template <int N> struct simdv;
+template <> struct simdv<2> {
+  typedef double d __attribute__((vector_size(16)));
+  typedef int64_t m __attribute__((vector_size(16)));
+};
+template <> struct simdv<4> {
+  typedef double d __attribute__((vector_size(32)));
+  typedef int64_t m __attribute__((vector_size(32)));
+};
+template <> struct simdv<8> {
+  typedef double d __attribute__((vector_size(64)));
+  typedef int64_t m __attribute__((vector_size(64)));
+};
+#pragma pop_macro("__attribute__")
+#else
+template <int N> struct dlanes {
+  double v[N];
+  double operator [] (int k) const { return v[k]; }
+  double &operator [] (int k) { return v[k]; }
+};
+template <int N> struct mlanes {
+  int64_t v[N];
+  int64_t operator [] (int k) const { return v[k]; }
+  int64_t &operator [] (int k) { return v[k]; }
+};
+#define LANES_OP(T, R, OP) \
+  template <int N> inline R<N> operator OP (const T<N> &a, const T<N> &b) \
+  { R<N> r; LANES(N) r[k] = a[k] OP b[k]; return r; }
+LANES_OP(dlanes, dlanes, +) LANES_OP(dlanes, dlanes, -)
+LANES_OP(dlanes, dlanes, *) LANES_OP(dlanes, dlanes, /)
+LANES_OP(mlanes, mlanes, &) LANES_OP(mlanes, mlanes, |)
+#undef LANES_OP
+#define LANES_CMP(OP) \
+  template <int N> inline mlanes<N> operator OP (const dlanes<N> &a, const dlanes<N> &b) \
+  { mlanes<N> r; LANES(N) r[k] = a[k] OP b[k] ? -1 : 0; return r; }
+LANES_CMP(<) LANES_CMP(<=) LANES_CMP(>) LANES_CMP(>=) LANES_CMP(==) LANES_CMP(!=)
+#undef LANES_CMP
+template <int N> inline dlanes<N> operator - (const dlanes<N> &a)
+{ dlanes<N> r; LANES(N) r[k] = -a[k]; return r; }
+template <int N> inline mlanes<N> operator ~ (const mlanes<N> &a)
+{ mlanes<N> r; LANES(N) r[k] = ~a[k]; return r; }
+template <int N> struct simdv {
+  typedef dlanes<N> d;
+  typedef mlanes<N> m;
+};
+#endif
+
+template <int N> struct simd : public simdv<N> {
+  typedef typename simdv<N>::d d;
+  typedef typename simdv<N>::m m;
+  static d splat(double s) { d r; LANES(N) r[k] = s; return r; }
+  static m splat(bool b) { m r; LANES(N) r[k] = b ? -1 : 0; return r; }
+  static d load(const double *p) { d r; LANES(N) r[k] = p[k]; return r; }
+#if defined(__GNUC__) || defined(__clang__)
+  static d select(const m &c, const d &a, const d &b) { return (d)(((m)a & c) | ((m)b & ~c)); }
+#else
+  static d select(const m &c, const d &a, const d &b) { d r; LANES(N) r[k] = c[k] ? a[k] : b[k]; return r; }
+#endif
+  static d fabs(const d &a) { d r; LANES(N) r[k] = ::fabs(a[k]); return r; }
+};
+
+/******************************** Types ***********************************/
+
+template <int N> class maskv {
+public:
+  typename simd<N>::m m;
+  maskv() { }
+  maskv(bool b) { m = simd<N>::splat(b); }
+  maskv(const typename simd<N>::m &m_) { m = m_; }
+  bool operator [] (int k) const { return m[k] != 0; }
+  void set(int k, bool b) { m[k] = b ? -1 : 0; }
+};
+
+template <int N> class doublev {
+public:
+  typename simd<N>::d v;
+  doublev() { }
+  doublev(double s) { v = simd<N>::splat(s); }
+  doublev(int s) { v = simd<N>::splat((double)s); }
+  doublev(const double *p) { v = simd<N>::load(p); }
+  doublev(const typename simd<N>::d &v_) { v = v_; }
+  double operator [] (int k) const { return v[k]; }
+  void set(int k, double s) { v[k] = s; }
+  void store(double *p) const { LANES(N) p[k] = v[k]; }
+};
+
+template <int N> class complexv {
+public:
+  typename simd<N>::d re, im;
+  complexv() { }
+  complexv(double r, double i = 0) { re = simd<N>::splat(r); im = simd<N>::splat(i); }
+  complexv(int r, int i = 0) : complexv((double)r, (double)i) { } // so complex4(0, 0) is not a row
+  complexv(const complex &z) { re = simd<N>::splat(z.re); im = simd<N>::splat(z.im); }
+  // N points on a row: xs[0..N-1] + i y
+  complexv(const double *xs, double y) { re = simd<N>::load(xs); im = simd<N>::splat(y); }
+  complexv(const doublev<N> &r, const doublev<N> &i) { re = r.v; im = i.v; }
+  complex lane(int k) const { return complex(re[k], im[k]); }
+  void set(int k, const complex &z) { re[k] = z.re; im[k] = z.im; }
+  doublev<N> real() const { return doublev<N>(re); }
+  doublev<N> imag() const { return doublev<N>(im); }
+  complexv& operator += (const complexv &r) { re = re + r.re; im = im + r.im; return *this; }
+  complexv& operator -= (const complexv &r) { re = re - r.re; im = im - r.im; return *this; }
+  complexv& operator *= (const complexv &r) { *this = *this * r; return *this; }
+  complexv& operator /= (const complexv &r) { *this = *this / r; return *this; }
+};
+
+typedef maskv<4> mask4;
+typedef maskv<8> mask8;
+typedef doublev<4> double4;
+typedef doublev<8> double8;
+typedef complexv<4> complex4;
+typedef complexv<8> complex8;
+typedef maskv<IT_SIMD_LANES> maskn;        // best width for this build
+typedef doublev<IT_SIMD_LANES> doublen;
+typedef complexv<IT_SIMD_LANES> complexn;
+
+/******************************** Masks ***********************************/
+
+template <int N> inline maskv<N> operator & (const maskv<N> &a, const maskv<N> &b) { return maskv<N>(a.m & b.m); }
+template <int N> inline maskv<N> operator | (const maskv<N> &a, const maskv<N> &b) { return maskv<N>(a.m | b.m); }
+template <int N> inline maskv<N> operator ~ (const maskv<N> &a) { return maskv<N>(~a.m); }
+template <int N> inline maskv<N> operator ! (const maskv<N> &a) { return ~a; }
+template <int N> inline bool any(const maskv<N> &a)
+{ int64_t r = 0; LANES(N) r |= a.m[k]; return r != 0; }
+template <int N> inline bool all(const maskv<N> &a)
+{ int64_t r = -1; LANES(N) r &= a.m[k]; return r != 0; }
+template <int N> inline bool none(const maskv<N> &a) { return !any(a); }
+template <int N> inline int count(const maskv<N> &a)
+{ int r = 0; LANES(N) r += a.m[k] != 0; return r; }
+
+/******************************** Reals ***********************************/
+
+#define DOUBLEV_OP(OP) \
+  template <int N> inline doublev<N> operator OP (const doublev<N> &a, const doublev<N> &b) \
+  { return doublev<N>(a.v OP b.v); } \
+  template <int N> inline doublev<N> operator OP (const doublev<N> &a, double b) \
+  { return doublev<N>(a.v OP simd<N>::splat(b)); } \
+  template <int N> inline doublev<N> operator OP (double a, const doublev<N> &b) \
+  { return doublev<N>(simd<N>::splat(a) OP b.v); }
+DOUBLEV_OP(+)
+DOUBLEV_OP(-)
+DOUBLEV_OP(*)
+DOUBLEV_OP(/)
+#undef DOUBLEV_OP
+
+#define DOUBLEV_CMP(OP) \
+  template <int N> inline maskv<N> operator OP (const doublev<N> &a, const doublev<N> &b) \
+  { return maskv<N>((typename simd<N>::m)(a.v OP b.v)); } \
+  template <int N> inline maskv<N> operator OP (const doublev<N> &a, double b) \
+  { return maskv<N>((typename simd<N>::m)(a.v OP simd<N>::splat(b))); }
+DOUBLEV_CMP(<)
+DOUBLEV_CMP(<=)
+DOUBLEV_CMP(>)
+DOUBLEV_CMP(>=)
+DOUBLEV_CMP(==)
+DOUBLEV_CMP(!=)
+#undef DOUBLEV_CMP
+
+template <int N> inline doublev<N> operator - (const doublev<N> &a) { return doublev<N>(-a.v); }
+
+// Per lane: c ? a : b
+template <int N> inline doublev<N> select(const maskv<N> &c, const doublev<N> &a, const doublev<N> &b)
+{ return doublev<N>(simd<N>::select(c.m, a.v, b.v)); }
+template <int N> inline doublev<N> select(const maskv<N> &c, double a, double b)
+{ return doublev<N>(simd<N>::select(c.m, simd<N>::splat(a), simd<N>::splat(b))); }
+template <int N> inline complexv<N> select(const maskv<N> &c, const complexv<N> &a, const complexv<N> &b) {
+  complexv<N> r;
+  r.re = simd<N>::select(c.m, a.re, b.re);
+  r.im = simd<N>::select(c.m, a.im, b.im);
+  return r;
+}
+
+template <int N> inline doublev<N> fabs(const doublev<N> &a) { return doublev<N>(simd<N>::fabs(a.v)); }
+template <int N> inline doublev<N> sqrt(const doublev<N> &a)
+{ doublev<N> r; LANES(N) r.set(k, ::sqrt(a[k])); return r; }
+template <int N> inline doublev<N> log(const doublev<N> &a)
+{ doublev<N> r; LANES(N) r.set(k, ::log(a[k])); return r; }
+template <int N> inline doublev<N> exp(const doublev<N> &a)
+{ doublev<N> r; LANES(N) r.set(k, ::exp(a[k])); return r; }
+
+/******************************* Complex **********************************/
+
+template <int N> inline complexv<N> operator + (const complexv<N> &x, const complexv<N> &y)
+{ complexv<N> r; r.re = x.re + y.re; r.im = x.im + y.im; return r; }
+template <int N> inline complexv<N> operator + (const complexv<N> &x, double y)
+{ complexv<N> r; r.re = x.re + simd<N>::splat(y); r.im = x.im; return r; }
+template <int N> inline complexv<N> operator + (double x, const complexv<N> &y) { return y + x; }
+template <int N> inline complexv<N> operator + (const complexv<N> &x, const complex &y) { return x + complexv<N>(y); }
+template <int N> inline complexv<N> operator + (const complex &x, const complexv<N> &y) { return complexv<N>(x) + y; }
+
+template <int N> inline complexv<N> operator - (const complexv<N> &x, const complexv<N> &y)
+{ complexv<N> r; r.re = x.re - y.re; r.im = x.im - y.im; return r; }
+template <int N> inline complexv<N> operator - (const complexv<N> &x, double y)
+{ complexv<N> r; r.re = x.re - simd<N>::splat(y); r.im = x.im; return r; }
+template <int N> inline complexv<N> operator - (double x, const complexv<N> &y)
+{ complexv<N> r; r.re = simd<N>::splat(x) - y.re; r.im = -y.im; return r; }
+template <int N> inline complexv<N> operator - (const complexv<N> &x, const complex &y) { return x - complexv<N>(y); }
+template <int N> inline complexv<N> operator - (const complex &x, const complexv<N> &y) { return complexv<N>(x) - y; }
+template <int N> inline complexv<N> operator - (const complexv<N> &x)
+{ complexv<N> r; r.re = -x.re; r.im = -x.im; return r; }
+
+template <int N> inline complexv<N> operator * (const complexv<N> &x, const complexv<N> &y) {
+  complexv<N> r;
+  r.re = x.re * y.re - x.im * y.im;
+  r.im = x.re * y.im + x.im * y.re;
+  return r;
+}
+template <int N> inline complexv<N> operator * (const complexv<N> &x, double y)
+{ complexv<N> r; r.re = x.re * simd<N>::splat(y); r.im = x.im * simd<N>::splat(y); return r; }
+template <int N> inline complexv<N> operator * (double x, const complexv<N> &y) { return y * x; }
+template <int N> inline complexv<N> operator * (const complexv<N> &x, const doublev<N> &y)
+{ complexv<N> r; r.re = x.re * y.v; r.im = x.im * y.v; return r; }
+template <int N> inline complexv<N> operator * (const doublev<N> &x, const complexv<N> &y) { return y * x; }
+template <int N> inline complexv<N> operator * (const complexv<N> &x, const complex &y) { return x * complexv<N>(y); }
+template <int N> inline complexv<N> operator * (const complex &x, const complexv<N> &y) { return complexv<N>(x) * y; }
+
+// Same scaling as complex operator / (Smith's method), selected per lane
+template <int N> inline complexv<N> operator / (const complexv<N> &x, const complexv<N> &y) {
+  typedef simd<N> S;
+  typename S::m c = (typename S::m)(S::fabs(y.re) <= S::fabs(y.im));
+  typename S::d t = S::select(c, y.re / y.im, y.im / y.re);
+  typename S::d d = S::select(c, y.im, y.re) * (S::splat(1.0) + t * t);
+  complexv<N> r;
+  r.re = S::select(c, x.re * t + x.im, x.re + x.im * t) / d;
+  r.im = S::select(c, x.im * t - x.re, x.im - x.re * t) / d;
+  return r;
+}
+template <int N> inline complexv<N> operator / (const complexv<N> &x, double y)
+{ complexv<N> r; r.re = x.re / simd<N>::splat(y); r.im = x.im / simd<N>::splat(y); return r; }
+template <int N> inline complexv<N> operator / (double x, const complexv<N> &y) { return complexv<N>(x) / y; }
+template <int N> inline complexv<N> operator / (const complexv<N> &x, const complex &y) { return x / complexv<N>(y); }
+template <int N> inline complexv<N> operator / (const complex &x, const complexv<N> &y) { return complexv<N>(x) / y; }
+
+template <int N> inline doublev<N> norm(const complexv<N> &x) { return doublev<N>(x.re * x.re + x.im * x.im); }
+template <int N> inline doublev<N> abs(const complexv<N> &x)
+{ doublev<N> r; LANES(N) r.set(k, ::hypot(x.re[k], x.im[k])); return r; }
+template <int N> inline doublev<N> arg(const complexv<N> &x)
+{ doublev<N> r; LANES(N) r.set(k, ::atan2(x.im[k], x.re[k])); return r; }
+template <int N> inline doublev<N> real(const complexv<N> &x) { return x.real(); }
+template <int N> inline doublev<N> imag(const complexv<N> &x) { return x.imag(); }
+template <int N> inline complexv<N> conj(const complexv<N> &x)
+{ complexv<N> r; r.re = x.re; r.im = -x.im; return r; }
+
+template <int N> inline complexv<N> exp(const complexv<N> &x) {
+  complexv<N> r;
+  LANES(N) {
+    double e = ::exp(x.re[k]);
+    r.re[k] = e * ::cos(x.im[k]);
+    r.im[k] = e * ::sin(x.im[k]);
+  }
+  return r;
+}
+template <int N> inline complexv<N> log(const complexv<N> &x) {
+  complexv<N> r;
+  LANES(N) {
+    r.re[k] = ::log(::hypot(x.re[k], x.im[k]));
+    r.im[k] = ::atan2(x.im[k], x.re[k]);
+  }
+  return r;
+}
+template <int N> inline complexv<N> sqrt(const complexv<N> &x)
+{ complexv<N> r; LANES(N) r.set(k, sqrt(x.lane(k))); return r; }
+template <int N> inline complexv<N> sin(const complexv<N> &x) {
+  complexv<N> r;
+  LANES(N) {
+    r.re[k] = ::sin(x.re[k]) * ::cosh(x.im[k]);
+    r.im[k] = ::cos(x.re[k]) * ::sinh(x.im[k]);
+  }
+  return r;
+}
+template <int N> inline complexv<N> cos(const complexv<N> &x) {
+  complexv<N> r;
+  LANES(N) {
+    r.re[k] = ::cos(x.re[k]) * ::cosh(x.im[k]);
+    r.im[k] = - ::sin(x.re[k]) * ::sinh(x.im[k]);
+  }
+  return r;
+}
+// Integer powers by repeated squaring, so z^2, z^3 stay fast
+template <int N> inline complexv<N> pow(const complexv<N> &x, int n) {
+  if (n < 0) return complexv<N>(1.0) / pow(x, -n);
+  complexv<N> r(1.0), b = x;
+  while (n > 0) {
+    if (n & 1) r = r * b;
+    n >>= 1;
+    if (n) b = b * b;
+  }
+  return r;
+}
+template <int N> inline complexv<N> pow(const complexv<N> &x, double y) { return exp(y * log(x)); }
+template <int N> inline complexv<N> pow(const complexv<N> &x, const complexv<N> &y) { return exp(y * log(x)); }
+
+#undef LANES
+#if defined(__GNUC__) || defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif /* __ITCOMPLEXV__ */
+
+/********************************* EOF ************************************/
@@ -0,0 +1,100 @@
+/************************************************************************
+
+    Copyright (C) 1998-2006  Mannes Technology (http://www.mannes-tech.com)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+*************************************************************************/
+
+#ifndef __ITCYCLE__
+#define __ITCYCLE__
+
+#include "MTComplex.h"
+#include "MTComplexV.h"
+
+/*
+ * Cycle detection for orbits (Brent): the orbit is saved after 1, 2, 4, 8...
+ * steps, and every new point is compared with the saved one. An orbit that
+ * has settled on an attracting cycle of period p comes back within the
+ * tolerance after at most about 2p steps once it is close, so interior
+ * points stop long before depth:
+ *
+ *   Cycle cycle(z, CYCLE_TOLERANCE);
+ *   for (i = 0; i < depth; i++) {
+ *     z = z * z + c;
+ *     if (norm(z) > escape * escape) break;
+ *     if (cycle.check(z)) return 1.0; // as if i reached depth
+ *   }
+ *
+ * The tolerance is in the units of z. CYCLE_TOLERANCE, a thousandth of the
+ * pixel spacing, leaves the images of the samples unchanged: much larger
+ * values take orbits that pass near a repelling cycle, or are still
+ * converging to a known attractor, for interior points. 0 only detects
+ * exact cycles.
+ * cyclen does the same for the IT_SIMD_LANES orbits of iterateRow, one flag
+ * per lane.
+ */
+
+class Cycle {
+  complex saved;
+  double tol2;
+  int power, steps;
+public:
+  Cycle() { start(complex(0, 0), 0); }
+  Cycle(const complex &z, double tolerance) { start(z, tolerance); }
+  void start(const complex &z, double tolerance) {
+    saved = z;
+    tol2 = tolerance * tolerance;
+    power = 1;
+    steps = 0;
+  }
+  // After each step: true if z is back at a saved point
+  bool check(const complex &z) {
+    if (norm(z - saved) <= tol2) return true;
+    if (++steps == power) {
+      saved = z;
+      power *= 2;
+      steps = 0;
+    }
+    return false;
+  }
+  int period() { return steps + 1; } // after check returned true
+};
+
+template <int N> class cyclev {
+  complexv<N> saved;
+  double tol2;
+  int power, steps;
+public:
+  cyclev(const complexv<N> &z, double tolerance) { start(z, tolerance); }
+  void start(const complexv<N> &z, double tolerance) {
+    saved = z;
+    tol2 = tolerance * tolerance;
+    power = 1;
+    steps = 0;
+  }
+  // The lanes that are back at a saved point
+  maskv<N> check(const complexv<N> &z) {
+    maskv<N> back = norm(z - saved) <= tol2;
+    if (++steps == power) {
+      saved = z;
+      power *= 2;
+      steps = 0;
+    }
+    return back;
+  }
+};
+
+typedef cyclev<IT_SIMD_LANES> cyclen;
+
+#endif /* __ITCYCLE__ */
+
+/********************************* EOF ************************************/
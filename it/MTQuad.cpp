@@ -0,0 +1,372 @@
+/************************************************************************
+
+    Copyright (C) 1998-2006  Mannes Technology (http://www.mannes-tech.com)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+*************************************************************************/
+
+#include "MTQuad.h"
+#include <cmath>
+#include <ctype.h>
+
+/*************************** Error-free sums *****************************/
+
+// s + err = a + b exactly, |a| >= |b|
+static inline double quick_two_sum(double a, double b, double &err) {
+  double s = a + b;
+  err = b - (s - a);
+  return s;
+}
+
+// s + err = a + b exactly
+static inline double two_sum(double a, double b, double &err) {
+  double s = a + b;
+  double bb = s - a;
+  err = (a - (s - bb)) + (b - bb);
+  return s;
+}
+
+// p + err = a * b exactly
+static inline double two_prod(double a, double b, double &err) {
+  double p = a * b;
+  err = std::fma(a, b, -p);
+  return p;
+}
+
+static inline void three_sum(double &a, double &b, double &c) {
+  double t1, t2, t3;
+  t1 = two_sum(a, b, t2);
+  a = two_sum(c, t1, t3);
+  b = two_sum(t2, t3, c);
+}
+
+static inline void three_sum2(double &a, double &b, double &c) {
+  double t1, t2, t3;
+  t1 = two_sum(a, b, t2);
+  a = two_sum(c, t1, t3);
+  b = t2 + t3;
+}
+
+static inline double quick_three_accum(double &a, double &b, double c) {
+  double s;
+  bool za, zb;
+  s = two_sum(b, c, b);
+  s = two_sum(a, s, a);
+  za = (a != 0.0);
+  zb = (b != 0.0);
+  if (za && zb) return s;
+  if (!zb) {
+    b = a;
+    a = s;
+  } else {
+    a = s;
+  }
+  return 0.0;
+}
+
+static void renorm(double &c0, double &c1, double &c2, double &c3) {
+  double s0, s1, s2 = 0.0, s3 = 0.0;
+  if (std::isinf(c0)) return;
+  s0 = quick_two_sum(c2, c3, c3);
+  s0 = quick_two_sum(c1, s0, c2);
+  c0 = quick_two_sum(c0, s0, c1);
+  s0 = c0;
+  s1 = c1;
+  if (s1 != 0.0) {
+    s1 = quick_two_sum(s1, c2, s2);
+    if (s2 != 0.0) s2 = quick_two_sum(s2, c3, s3);
+    else s1 = quick_two_sum(s1, c3, s2);
+  } else {
+    s0 = quick_two_sum(s0, c2, s1);
+    if (s1 != 0.0) s1 = quick_two_sum(s1, c3, s2);
+    else s0 = quick_two_sum(s0, c3, s1);
+  }
+  c0 = s0; c1 = s1; c2 = s2; c3 = s3;
+}
+
+static void renorm(double &c0, double &c1, double &c2, double &c3, double &c4) {
+  double s0, s1, s2 = 0.0, s3 = 0.0;
+  if (std::isinf(c0)) return;
+  s0 = quick_two_sum(c3, c4, c4);
+  s0 = quick_two_sum(c2, s0, c3);
+  s0 = quick_two_sum(c1, s0, c2);
+  c0 = quick_two_sum(c0, s0, c1);
+  s0 = c0;
+  s1 = c1;
+  if (s1 != 0.0) {
+    s1 = quick_two_sum(s1, c2, s2);
+    if (s2 != 0.0) {
+      s2 = quick_two_sum(s2, c3, s3);
+      if (s3 != 0.0) s3 += c4;
+      else s2 = quick_two_sum(s2, c4, s3);
+    } else {
+      s1 = quick_two_sum(s1, c3, s2);
+      if (s2 != 0.0) s2 = quick_two_sum(s2, c4, s3);
+      else s1 = quick_two_sum(s1, c4, s2);
+    }
+  } else {
+    s0 = quick_two_sum(s0, c2, s1);
+    if (s1 != 0.0) {
+      s1 = quick_two_sum(s1, c3, s2);
+      if (s2 != 0.0) s2 = quick_two_sum(s2, c4, s3);
+      else s1 = quick_two_sum(s1, c4, s2);
+    } else {
+      s0 = quick_two_sum(s0, c3, s1);
+      if (s1 != 0.0) s1 = quick_two_sum(s1, c4, s2);
+      else s0 = quick_two_sum(s0, c4, s1);
+    }
+  }
+  c0 = s0; c1 = s1; c2 = s2; c3 = s3;
+}
+
+/****************************** Arithmetic *******************************/
+
+// Merges the components of a and b by magnitude (QD's ieee_add)
+qdouble operator + (const qdouble &a, const qdouble &b) {
+  int i = 0, j = 0, k = 0;
+  double s, t, u, v;
+  double x[4] = { 0.0, 0.0, 0.0, 0.0 };
+  if (std::fabs(a.x[i]) > std::fabs(b.x[j])) u = a.x[i++]; else u = b.x[j++];
+  if (std::fabs(a.x[i]) > std::fabs(b.x[j])) v = a.x[i++]; else v = b.x[j++];
+  u = quick_two_sum(u, v, v);
+  while (k < 4) {
+    if (i >= 4 && j >= 4) {
+      x[k] = u;
+      if (k < 3) x[++k] = v;
+      break;
+    }
+    if (i >= 4) t = b.x[j++];
+    else if (j >= 4) t = a.x[i++];
+    else if (std::fabs(a.x[i]) > std::fabs(b.x[j])) t = a.x[i++];
+    else t = b.x[j++];
+    s = quick_three_accum(u, v, t);
+    if (s != 0.0) x[k++] = s;
+  }
+  for (k = i; k < 4; k++) x[3] += a.x[k];
+  for (k = j; k < 4; k++) x[3] += b.x[k];
+  renorm(x[0], x[1], x[2], x[3]);
+  return qdouble(x[0], x[1], x[2], x[3]);
+}
+
+qdouble operator + (const qdouble &a, double b) {
+  double c0, c1, c2, c3, e;
+  c0 = two_sum(a.x[0], b, e);
+  c1 = two_sum(a.x[1], e, e);
+  c2 = two_sum(a.x[2], e, e);
+  c3 = two_sum(a.x[3], e, e);
+  renorm(c0, c1, c2, c3, e);
+  return qdouble(c0, c1, c2, c3);
+}
+
+qdouble operator - (const qdouble &a) {
+  return qdouble(-a.x[0], -a.x[1], -a.x[2], -a.x[3]);
+}
+
+qdouble operator - (const qdouble &a, const qdouble &b) {
+  return a + (-b);
+}
+
+qdouble operator * (const qdouble &a, double b) {
+  double p0, p1, p2, p3;
+  double q0, q1, q2;
+  double s0, s1, s2, s3, s4;
+  p0 = two_prod(a.x[0], b, q0);
+  p1 = two_prod(a.x[1], b, q1);
+  p2 = two_prod(a.x[2], b, q2);
+  p3 = a.x[3] * b;
+  s0 = p0;
+  s1 = two_sum(q0, p1, s2);
+  three_sum(s2, q1, p2);
+  three_sum2(q1, q2, p3);
+  s3 = q1;
+  s4 = q2 + p2;
+  renorm(s0, s1, s2, s3, s4);
+  return qdouble(s0, s1, s2, s3);
+}
+
+// Terms up to O(eps^3) (QD's sloppy_mul)
+qdouble operator * (const qdouble &a, const qdouble &b) {
+  double p0, p1, p2, p3, p4, p5;
+  double q0, q1, q2, q3, q4, q5;
+  double t0, t1;
+  double s0, s1, s2;
+  p0 = two_prod(a.x[0], b.x[0], q0);
+  p1 = two_prod(a.x[0], b.x[1], q1);
+  p2 = two_prod(a.x[1], b.x[0], q2);
+  p3 = two_prod(a.x[0], b.x[2], q3);
+  p4 = two_prod(a.x[1], b.x[1], q4);
+  p5 = two_prod(a.x[2], b.x[0], q5);
+  three_sum(p1, p2, q0);
+  three_sum(p2, q1, q2);
+  three_sum(p3, p4, p5);
+  s0 = two_sum(p2, p3, t0);
+  s1 = two_sum(q1, p4, t1);
+  s2 = q2 + p5;
+  s1 = two_sum(s1, t0, t0);
+  s2 += (t0 + t1);
+  s1 += a.x[0] * b.x[3] + a.x[1] * b.x[2] + a.x[2] * b.x[1] + a.x[3] * b.x[0] + q0 + q3 + q4 + q5;
+  renorm(p0, p1, s0, s1, s2);
+  return qdouble(p0, p1, s0, s1);
+}
+
+qdouble operator / (const qdouble &a, const qdouble &b) {
+  double q0, q1, q2, q3;
+  qdouble r;
+  q0 = a.x[0] / b.x[0];
+  r = a - (b * q0);
+  q1 = r.x[0] / b.x[0];
+  r = r - (b * q1);
+  q2 = r.x[0] / b.x[0];
+  r = r - (b * q2);
+  q3 = r.x[0] / b.x[0];
+  renorm(q0, q1, q2, q3);
+  return qdouble(q0, q1, q2, q3);
+}
+
+qdouble operator / (const qdouble &a, double b) {
+  return a / qdouble(b);
+}
+
+qdouble& qdouble::operator += (const qdouble &b) { *this = *this + b; return *this; }
+qdouble& qdouble::operator -= (const qdouble &b) { *this = *this - b; return *this; }
+qdouble& qdouble::operator *= (const qdouble &b) { *this = *this * b; return *this; }
+qdouble& qdouble::operator /= (const qdouble &b) { *this = *this / b; return *this; }
+
+qdouble sqr(const qdouble &a) {
+  return a * a;
+}
+
+qdouble fabs(const qdouble &a) {
+  return a.x[0] < 0.0 ? -a : a;
+}
+
+qdouble floor(const qdouble &a) {
+  double x0, x1, x2, x3;
+  x1 = x2 = x3 = 0.0;
+  x0 = std::floor(a.x[0]);
+  if (x0 == a.x[0]) {
+    x1 = std::floor(a.x[1]);
+    if (x1 == a.x[1]) {
+      x2 = std::floor(a.x[2]);
+      if (x2 == a.x[2]) x3 = std::floor(a.x[3]);
+    }
+    renorm(x0, x1, x2, x3);
+  }
+  return qdouble(x0, x1, x2, x3);
+}
+
+bool operator < (const qdouble &a, const qdouble &b) {
+  for (int i = 0; i < 4; i++) {
+    if (a.x[i] != b.x[i]) return a.x[i] < b.x[i];
+  }
+  return false;
+}
+
+bool operator == (const qdouble &a, const qdouble &b) {
+  return a.x[0] == b.x[0] && a.x[1] == b.x[1] && a.x[2] == b.x[2] && a.x[3] == b.x[3];
+}
+
+/******************************* Strings *********************************/
+
+static qdouble pow10(int n) {
+  qdouble r(1.0), b(10.0);
+  bool neg = n < 0;
+  if (neg) n = -n;
+  while (n > 0) {
+    if (n & 1) r = r * b;
+    n >>= 1;
+    if (n) b = b * b;
+  }
+  return neg ? qdouble(1.0) / r : r;
+}
+
+// [-+]digits[.digits][(e|E)[-+]digits], leading/trailing blanks allowed
+qdouble qdouble::fromString(const char *s, bool *ok) {
+  qdouble r;
+  int sign = 1, point = -1, nd = 0, e = 0;
+  bool good = false;
+  if (ok) *ok = false;
+  if (s == nullptr) return r;
+  while (isspace((unsigned char)*s)) s++;
+  if (*s == '-' || *s == '+') { if (*s == '-') sign = -1; s++; }
+  for (; *s; s++) {
+    if (isdigit((unsigned char)*s)) {
+      r = r * 10.0 + (double)(*s - '0');
+      nd++;
+      good = true;
+    } else if (*s == '.' && point < 0) {
+      point = nd;
+    } else break;
+  }
+  if (!good) return qdouble();
+  if (*s == 'e' || *s == 'E') {
+    s++;
+    int esign = 1;
+    if (*s == '-' || *s == '+') { if (*s == '-') esign = -1; s++; }
+    if (!isdigit((unsigned char)*s)) return qdouble();
+    while (isdigit((unsigned char)*s)) { e = e * 10 + (*s - '0'); s++; }
+    e *= esign;
+  }
+  while (isspace((unsigned char)*s)) s++;
+  if (*s) return qdouble();
+  if (point >= 0) e -= nd - point;
+  if (e != 0) r = r * pow10(e);
+  if (ok) *ok = true;
+  return sign < 0 ? -r : r;
+}
+
+// Scientific notation with the given number of significant digits,
+// trailing zeros removed: "-1.2345e-52", "0", "2.5"
+std::string qdouble::toString(int digits) const {
+  if (digits < 1) digits = 1;
+  if (digits > 64) digits = 64;
+  if (std::isnan(x[0])) return "nan";
+  if (std::isinf(x[0])) return x[0] < 0 ? "-inf" : "inf";
+  if (x[0] == 0.0) return "0";
+  qdouble r = fabs(*this);
+  int e = (int)std::floor(std::log10(std::fabs(x[0])));
+  r = r / pow10(e);
+  if (r >= qdouble(10.0)) { r = r / 10.0; e++; }
+  if (r < qdouble(1.0)) { r = r * 10.0; e--; }
+  // one extra digit for rounding
+  int d[66];
+  for (int i = 0; i <= digits; i++) {
+    int v = (int)r.x[0];
+    if (v > 9) v = 9;
+    r = r - (double)v;
+    if (r.x[0] < 0.0) { v--; r = r + 1.0; }
+    d[i] = v < 0 ? 0 : v;
+    r = r * 10.0;
+  }
+  if (d[digits] >= 5) {
+    int i = digits - 1;
+    while (i >= 0 && ++d[i] == 10) { d[i] = 0; i--; }
+    if (i < 0) { // 9.99.. rounded up to 10
+      for (int k = digits - 1; k > 0; k--) d[k] = d[k - 1];
+      d[0] = 1;
+      e++;
+    }
+  }
+  int last = digits - 1;
+  while (last > 0 && d[last] == 0) last--;
+  std::string s;
+  if (x[0] < 0.0) s += '-';
+  s += (char)('0' + d[0]);
+  if (last > 0) {
+    s += '.';
+    for (int i = 1; i <= last; i++) s += (char)('0' + d[i]);
+  }
+  if (e != 0) s += "e" + std::to_string(e);
+  return s;
+}
+
+/********************************* EOF ************************************/
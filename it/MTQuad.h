@@ -0,0 +1,97 @@
+/************************************************************************
+
+    Copyright (C) 1998-2006  Mannes Technology (http://www.mannes-tech.com)
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    **************************************************************
+    * The algorithms follow the QD library by Y. Hida, X. S. Li and
+    * D. H. Bailey, "Library for Double-Double and Quad-Double
+    * Arithmetic" (2007).
+    **************************************************************
+
+*************************************************************************/
+
+#ifndef __ITQUAD__
+#define __ITQUAD__
+
+#include <string>
+
+/*
+ * Quad-double: an unevaluated sum of four doubles x[0] + x[1] + x[2] + x[3]
+ * with |x[i+1]| <= ulp(x[i])/2, about 62 significant decimal digits. Used
+ * for view coordinates and reference orbits of deep zooms.
+ */
+class qdouble {
+public:
+  double x[4];
+  qdouble() { x[0] = x[1] = x[2] = x[3] = 0.0; }
+  qdouble(double d) { x[0] = d; x[1] = x[2] = x[3] = 0.0; }
+  qdouble(double a, double b, double c, double d) { x[0] = a; x[1] = b; x[2] = c; x[3] = d; }
+  explicit qdouble(const char *s) { *this = fromString(s); }
+  double toDouble() const { return x[0] + (x[1] + (x[2] + x[3])); }
+  double operator [] (int i) const { return x[i]; }
+  qdouble& operator += (const qdouble &b);
+  qdouble& operator -= (const qdouble &b);
+  qdouble& operator *= (const qdouble &b);
+  qdouble& operator /= (const qdouble &b);
+  // digits: significant decimal digits (at most 64)
+  std::string toString(int digits = 64) const;
+  static qdouble fromString(const char *s, bool *ok = nullptr);
+  static qdouble fromString(const std::string &s, bool *ok = nullptr) { return fromString(s.c_str(), ok); }
+};
+
+qdouble operator + (const qdouble &a, const qdouble &b);
+qdouble operator + (const qdouble &a, double b);
+qdouble operator - (const qdouble &a, const qdouble &b);
+qdouble operator - (const qdouble &a);
+qdouble operator * (const qdouble &a, const qdouble &b);
+qdouble operator * (const qdouble &a, double b);
+qdouble operator / (const qdouble &a, const qdouble &b);
+qdouble operator / (const qdouble &a, double b);
+inline qdouble operator + (double a, const qdouble &b) { return b + a; }
+inline qdouble operator - (const qdouble &a, double b) { return a + (-b); }
+inline qdouble operator - (double a, const qdouble &b) { return (-b) + a; }
+inline qdouble operator * (double a, const qdouble &b) { return b * a; }
+inline qdouble operator / (double a, const qdouble &b) { return qdouble(a) / b; }
+
+bool operator < (const qdouble &a, const qdouble &b);
+bool operator == (const qdouble &a, const qdouble &b);
+inline bool operator > (const qdouble &a, const qdouble &b) { return b < a; }
+inline bool operator <= (const qdouble &a, const qdouble &b) { return !(b < a); }
+inline bool operator >= (const qdouble &a, const qdouble &b) { return !(a < b); }
+inline bool operator != (const qdouble &a, const qdouble &b) { return !(a == b); }
+
+qdouble sqr(const qdouble &a);
+qdouble fabs(const qdouble &a);
+qdouble floor(const qdouble &a);
+
+/*
+ * Complex number with quad-double parts, for reference orbits
+ */
+class qcomplex {
+public:
+  qdouble re, im;
+  qcomplex() { }
+  qcomplex(const qdouble &r, const qdouble &i) : re(r), im(i) { }
+};
+
+inline qcomplex operator + (const qcomplex &a, const qcomplex &b) { return qcomplex(a.re + b.re, a.im + b.im); }
+inline qcomplex operator - (const qcomplex &a, const qcomplex &b) { return qcomplex(a.re - b.re, a.im - b.im); }
+inline qcomplex operator * (const qcomplex &a, const qcomplex &b) {
+  return qcomplex(a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re);
+}
+inline qcomplex sqr(const qcomplex &a) { return qcomplex(sqr(a.re) - sqr(a.im), (a.re * a.im) * 2.0); }
+inline qdouble norm(const qcomplex &a) { return sqr(a.re) + sqr(a.im); }
+
+#endif /* __ITQUAD__ */
+
+/********************************* EOF ************************************/
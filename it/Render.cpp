@@ -0,0 +1,368 @@
+#include "Render.h"
+#include "Function.h"
+#include "State.h"
+#include "Algo.h"
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+
+Tile::Tile(Renderer *r, int x_, int y_, int w_, int h_, Function *f) : random(1 + y_ * 65536 + x_) {
+  renderer = r; fun = f; x = x_; y = y_; w = w_; h = h_;
+  hw = w / 2; hh = h / 2; w2 = w - hw; h2 = h - hh;
+  phase = 0;
+  waiting = 0;
+}
+
+Tile::~Tile() { if (fun && fun->iscopy) delete fun; }
+
+bool Tile::run() { return renderer->renderTile(this); }
+
+///////////////////////////////////////////////////////////////////////////////
+
+Renderer::Renderer(int cores_) {
+  cores = std::max(1, cores_);
+  tilesize = 50; // see TODO.md: 50 is best, and a multiple of common sizes
+  rendering = false;
+  pendingPixels = 0;
+  pendingTiles = 0;
+  totalPixels = 0;
+  aaSamples = 0;
+  aaThreshold = 0.02;
+  antialiasing = false;
+  function = nullptr;
+  state = nullptr;
+  algorithm = nullptr;
+  gridw = 1;
+  profile = false;
+  for (auto &ns: phaseNanos) ns = 0;
+  scheduler = new Scheduler(cores);
+}
+
+Renderer::~Renderer() {
+  stop();
+  delete scheduler;
+}
+
+void Renderer::begin(Function *function_, State *state_) {
+  function = function_;
+  state = state_;
+  totalPixels = state->getWidth() * state->getHeight();
+  pendingPixels = totalPixels;
+  for (auto &ns: phaseNanos) ns = 0;
+  if ((int)aaOffsets.size() != 2 * aaSamples) { // Halton points, bases 2 and 3
+    QuasiRandom hx(1), hy(2);
+    aaOffsets.clear();
+    for (int k = 0; k < aaSamples; k++) {
+      aaOffsets.push_back(hx.uniform());
+      aaOffsets.push_back(hy.uniform());
+    }
+  }
+  rendering = true;
+}
+
+void Renderer::start(Function *function_, State *state_, bool singlethreaded) {
+  if (rendering.load()) stop();
+  begin(function_, state_);
+  if (!function->algorithm.empty()) {
+    algorithm = makeAlgorithm(function->algorithm.c_str());
+    algorithm->start(function, state);
+    algorithm->prepare(function);
+  }
+  // algorithms compute whole pixels only
+  antialiasing = aaSamples > 0 && algorithm == nullptr && state->getWidth() > 1 && state->getHeight() > 1;
+  int w = state->getWidth();
+  int h = state->getHeight();
+  grid.clear();
+  gridw = 1;
+  if (singlethreaded) {
+    Tile *tile = new Tile(this, 0, 0, w, h, function->copy_());
+    tile->phase = 4; // calc all directly
+    tiles.push_back(tile);
+    grid.push_back(tile);
+  } else {
+#if 0 // STRIPES
+    int th = h / cores;
+    for (int y = 0; y < h; y += th) {
+      int tile_h = std::min(th, h - y);
+      Tile *tile = new Tile(this, 0, y, w, tile_h, function->copy_());
+      tile->phase = 4;
+      tiles.push_back(tile);
+    }
+#else
+    gridw = (w + tilesize - 1) / tilesize;
+    for (int y = 0; y < h; y += tilesize) {
+      for (int x = 0; x < w; x += tilesize) {
+        int tile_w = std::min(tilesize, w - x);
+        int tile_h = std::min(tilesize, h - y);
+        bool seeded = state->isRegionSet(x, y, tile_w, tile_h); // from a previous frame
+        if (seeded) pendingPixels -= tile_w * tile_h;
+        if (seeded && !antialiasing) {
+          grid.push_back(nullptr);
+          continue;
+        }
+        Tile *tile = new Tile(this, x, y, tile_w, tile_h, function->copy_());
+        if (seeded) { // only phase 5: finish() replaces all samples
+          tile->phase = 5;
+          rowBuffers(tile);
+        }
+        tiles.push_back(tile);
+        grid.push_back(tile);
+      }
+    }
+#endif
+  }
+  if (tiles.empty()) {
+    antialiasing = false; // nothing rendered: keep the frame's samples
+    if (finished) finished();
+    return;
+  }
+  pendingTiles = antialiasing ? (int)tiles.size() : 0;
+  if (antialiasing) { // count what phase 5 of each tile waits for
+    int gh = (int)grid.size() / gridw;
+    auto computing = [](Tile *t) { return t && t->phase < 5 ? 1 : 0; };
+    std::vector<Task*> ready; // the rest is queued by doneComputing
+    for (int i = 0; i < (int)grid.size(); i++) {
+      if (grid[i] == nullptr) continue;
+      int gx = i % gridw, gy = i / gridw, n = computing(grid[i]);
+      if (gx > 0) n += computing(grid[i - 1]);
+      if (gx + 1 < gridw) n += computing(grid[i + 1]);
+      if (gy > 0) n += computing(grid[i - gridw]);
+      if (gy + 1 < gh) n += computing(grid[i + gridw]);
+      grid[i]->waiting = n;
+      if (grid[i]->phase < 5 || n == 0) ready.push_back(grid[i]);
+    }
+    scheduler->submit(ready);
+    return;
+  }
+  scheduler->submit(tiles);
+}
+
+void Renderer::stop() {
+  rendering = false;
+  scheduler->cancel();
+  for (Task *tile: tiles) delete tile;
+  tiles.clear();
+  delete algorithm;
+  algorithm = nullptr;
+}
+
+bool Renderer::finish() {
+  if (pendingPixels.load() != 0 || pendingTiles.load() != 0) return false;
+  scheduler->wait();
+  rendering = false;
+  if (antialiasing) { // publish the supersamples, sorted by pixel index
+    std::vector<std::pair<int, const double *>> all;
+    for (Task *task: tiles) {
+      Tile *tile = (Tile *)task;
+      for (size_t i = 0; i < tile->aai.size(); i++) all.emplace_back(tile->aai[i], tile->aav.data() + i * aaSamples);
+    }
+    std::sort(all.begin(), all.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+    std::vector<int> index;
+    std::vector<double> values;
+    index.reserve(all.size());
+    values.reserve(all.size() * aaSamples);
+    for (auto &p: all) {
+      index.push_back(p.first);
+      values.insert(values.end(), p.second, p.second + aaSamples);
+    }
+    state->setSamples(std::move(index), std::move(values), aaSamples);
+  }
+  for (Task *tile: tiles) delete tile;
+  tiles.clear();
+  delete algorithm;
+  algorithm = nullptr;
+  return true;
+}
+
+void Renderer::wait() {
+  scheduler->wait();
+}
+
+int Renderer::progress() {
+  if (totalPixels == 0) return 100;
+  return 100 - (int)((100LL * pendingPixels.load()) / totalPixels);
+}
+
+double Renderer::pixel(Tile *tile, int x, int y) {
+  int index = state->getPixelIndex(x, y);
+  if (state->isSetAt(index)) return state->getPixelAt(index); // seeded
+  double xx = state->X(x), out;
+  if (algorithm == nullptr) return tile->fun->iterate_(xx, state->Y(y));
+  algorithm->computeRow(tile->fun, &xx, x, y, 1, &out);
+  return out;
+}
+
+bool Renderer::renderTile(Tile *tile) {
+  if (!profile) return renderPhase(tile);
+  int phase = std::min(tile->phase, 5);
+  auto t0 = std::chrono::steady_clock::now();
+  bool more = renderPhase(tile);
+  phaseNanos[phase] += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+  return more;
+}
+
+// 0---1---+
+// |   |   |
+// 2-- 3---+
+// |   |   |
+// +---+---+
+bool Renderer::renderPhase(Tile *tile) {
+  int pp = -1;
+  if (!rendering.load()) return false;
+  if (tile->phase == 0) {
+    state->setPixelRegion(tile->x, tile->y, pixel(tile, tile->x, tile->y), tile->w, tile->h);
+
+  } else if (tile->phase == 1) {
+    int x = tile->x + tile->hw;
+    int y = tile->y;
+    int w = tile->w2;
+    int h = tile->hh;
+    state->setPixelRegion(x, y, pixel(tile, x, y), w, h);
+  } else if (tile->phase == 2) {
+    int x = tile->x;
+    int y = tile->y + tile->hh;
+    int w = tile->hw;
+    int h = tile->h2;
+    state->setPixelRegion(x, y, pixel(tile, x, y), w, h);
+  } else if (tile->phase == 3) {
+    int x = tile->x + tile->hw;
+    int y = tile->y + tile->hh;
+    int w = tile->w2;
+    int h = tile->h2;
+    state->setPixelRegion(x, y, pixel(tile, x, y), w, h);
+  } else if (tile->phase == 5) {
+    return antialias(tile);
+  } else { // phase 4: compute the unset pixels
+    int w = tile->w;
+    rowBuffers(tile);
+    if (tile->fun->subdivide) {
+      auto row = [this, tile](int x, int y, int n) { return computeSpan(tile, x, y, n); };
+      if (!subdivideRect(state, tile->x, tile->y, w, tile->h, row)) return false;
+      pp = pendingPixels.fetch_sub(w * tile->h) - w * tile->h;
+    } else {
+      for (int y = tile->y; y < tile->y + tile->h; y++) {
+        if (!computeSpan(tile, tile->x, y, w)) return false;
+        pp = pendingPixels.fetch_sub(w) - w;
+      }
+    }
+    if (antialiasing) return doneComputing(tile);
+    if (pp == 0 && finished) finished();
+    return false;
+  }
+  tile->phase++;
+  return true;
+}
+
+// The row buffers of phases 4 and 5, with the x of every column
+void Renderer::rowBuffers(Tile *tile) {
+  int w = tile->w;
+  tile->xs.resize(w);
+  tile->out.resize(w);
+  tile->gx.resize(w);
+  tile->gi.resize(w);
+  for (int i = 0; i < w; i++) tile->xs[i] = state->X(tile->x + i);
+}
+
+// Pixels x..x+n-1 of row y, inside tile; false when stopped
+bool Renderer::computeSpan(Tile *tile, int x, int y, int n) {
+  if (!rendering.load()) return false;
+  double *xs = tile->xs.data() + (x - tile->x);
+  double *out = tile->out.data();
+  double *gx = tile->gx.data();
+  int *gi = tile->gi.data();
+  double yy = state->Y(y);
+  for (int s = 0; s < n; ) { // segments with consecutive pixel indices
+    int e = s + std::min(state->getRunLength(x + s), n - s);
+    int idx = state->getPixelIndex(x + s, y) - s;
+    if (algorithm == nullptr) { // gather, so seeded gaps keep iterateRow vectors full
+      int m = 0;
+      for (int i = s; i < e; i++) {
+        if (state->isSetAt(idx + i)) continue;
+        gx[m] = xs[i];
+        gi[m++] = i;
+      }
+      if (m > 0) tile->fun->iterateRow(gx, yy, out, m);
+      for (int k = 0; k < m; k++) state->setPixelAt(idx + gi[k], out[k]);
+      s = e;
+      continue;
+    }
+    int i = s; // the algorithm needs consecutive pixels: one call per run
+    while (i < e) {
+      if (state->isSetAt(idx + i)) { i++; continue; }
+      int j = i + 1;
+      while (j < e && !state->isSetAt(idx + j)) j++;
+      algorithm->computeRow(tile->fun, xs + i, x + i, y, j - i, out + i);
+      for (int k = i; k < j; k++) state->setPixelAt(idx + k, out[k]);
+      i = j;
+    }
+    s = e;
+  }
+  return true;
+}
+
+// After phase 4 of tile: phase 5 of the tile and of its 4-neighbours can run
+// once none of them is still computing. The last of them to finish queues it,
+// so phase 5 never waits on a worker. Returns true if the tile itself is ready.
+bool Renderer::doneComputing(Tile *tile) {
+  tile->phase = 5;
+  int gh = (int)grid.size() / gridw;
+  int gx = tile->x / tilesize, gy = tile->y / tilesize;
+  bool ready = false;
+  auto done = [this, tile, &ready](Tile *t) {
+    if (t == nullptr || --t->waiting != 0) return;
+    if (t == tile) ready = true;
+    else scheduler->submit(t);
+  };
+  if (gx > 0) done(grid[gy * gridw + gx - 1]);
+  if (gx + 1 < gridw) done(grid[gy * gridw + gx + 1]);
+  if (gy > 0) done(grid[(gy - 1) * gridw + gx]);
+  if (gy + 1 < gh) done(grid[(gy + 1) * gridw + gx]);
+  done(tile);
+  return ready;
+}
+
+static bool differ(double a, double b, double threshold) {
+  if (isRGB(a) || isRGB(b)) return !(isRGB(a) && isRGB(b) && rgbOf(a) == rgbOf(b));
+  return fabs(a - b) > threshold;
+}
+
+// Phase 5: supersample the pixels of the tile that differ from a 4-neighbour
+// by more than aaThreshold, at aaSamples jittered sub-pixel positions. The
+// values are published to State by finish(). Only queued by doneComputing,
+// when the neighbouring pixels are final.
+bool Renderer::antialias(Tile *tile) {
+  int W = state->getWidth(), H = state->getHeight();
+  int x0 = tile->x, y0 = tile->y, x1 = x0 + tile->w, y1 = y0 + tile->h;
+  int n = aaSamples;
+  double px = state->X(1) - state->X(0), py = state->Y(1) - state->Y(0);
+  double *gx = tile->gx.data();
+  double *out = tile->out.data();
+  int *gi = tile->gi.data();
+  for (int y = y0; y < y1; y++) {
+    if (!rendering.load()) return false;
+    int m = 0;
+    for (int x = x0; x < x1; x++) {
+      double v = state->getPixel(x, y);
+      if ((x > 0 && differ(v, state->getPixel(x - 1, y), aaThreshold)) ||
+          (x + 1 < W && differ(v, state->getPixel(x + 1, y), aaThreshold)) ||
+          (y > 0 && differ(v, state->getPixel(x, y - 1), aaThreshold)) ||
+          (y + 1 < H && differ(v, state->getPixel(x, y + 1), aaThreshold))) gi[m++] = x - x0;
+    }
+    if (m == 0) continue;
+    size_t base = tile->aav.size();
+    tile->aav.resize(base + (size_t)m * n);
+    double jx = tile->random.uniform(0, 1), jy = tile->random.uniform(0, 1); // per row
+    for (int k = 0; k < n; k++) {
+      double ox = fmod(aaOffsets[2 * k] + jx, 1.0) - 0.5;
+      double oy = fmod(aaOffsets[2 * k + 1] + jy, 1.0) - 0.5;
+      for (int j = 0; j < m; j++) gx[j] = tile->xs[gi[j]] + ox * px;
+      tile->fun->iterateRow(gx, state->Y(y) + oy * py, out, m);
+      for (int j = 0; j < m; j++) tile->aav[base + (size_t)j * n + k] = out[j];
+    }
+    for (int j = 0; j < m; j++) tile->aai.push_back(state->getPixelIndex(x0 + gi[j], y));
+  }
+  if (--pendingTiles == 0 && finished) finished();
+  return false;
+}
+
+/******************************** EOF ***********************************/
@@ -0,0 +1,81 @@
+#pragma once
+#include "Scheduler.h"
+#include "MTRandom.h"
+#include <atomic>
+#include <vector>
+#include <functional>
+
+class Function;
+class State;
+class Renderer;
+class Algorithm;
+
+// A rectangle of the image. Phases 0-3 set a coarse preview, phase 4
+// computes every pixel, phase 5 supersamples edges (see Renderer::renderTile).
+class Tile : public Task {
+public:
+  int x, y; // top left corner
+  int w, h; // dimensions
+  int hw, hh, w2, h2;
+  Function *fun;  // copy of function - use for thread safety
+  Renderer *renderer;
+  std::vector<double> xs, out, gx; // phase 4 row buffers
+  std::vector<int> gi;             // positions of the gathered gx
+  std::vector<int> aai;            // phase 5: supersampled pixel indices
+  std::vector<double> aav;         // and their Renderer::aaSamples values
+  Random random;                   // jitter of the supersamples
+  std::atomic<int> waiting;        // phase 5: this tile and 4-neighbours before it
+
+public:
+  Tile(Renderer *r, int x_, int y_, int w_, int h_, Function *f);
+  ~Tile();
+  bool run() override;
+  inline int size() { return w * h; }
+};
+
+// Renders a State with a Function on all cores, without any Qt.
+class Renderer {
+public:
+  Renderer(int cores);
+  ~Renderer();
+  void begin(Function *function, State *state);
+  void start(Function *function, State *state, bool singlethreaded = false);
+  void stop();      // cancel, wait for workers, free tiles
+  bool finish();    // after finished(): free tiles; false if still running
+  void wait();      // block until all tiles are done
+  bool renderTile(Tile *tile);
+  bool renderPhase(Tile *tile);
+  bool computeSpan(Tile *tile, int x, int y, int n); // unset pixels of a row
+  bool antialias(Tile *tile);
+  bool doneComputing(Tile *tile);
+  void rowBuffers(Tile *tile);
+  double pixel(Tile *tile, int x, int y);
+
+  bool isRendering() { return rendering.load(); }
+  int progress();   // percent done
+public:
+  int cores;
+  int tilesize;
+  std::function<void()> finished; // called on a worker thread
+  std::atomic<bool> rendering;
+  std::atomic<int> pendingPixels;
+  std::atomic<int> pendingTiles;  // not yet antialiased
+  int totalPixels;
+  int aaSamples;      // supersample edge pixels after phase 4 (0: off)
+  double aaThreshold; // edge: a 4-neighbour differs by more than this
+  bool profile; // sum worker time per phase in phaseNanos (see bench/)
+  std::atomic<long long> phaseNanos[6];
+private:
+  Scheduler *scheduler;
+  Function *function;
+  State *state;
+  Algorithm *algorithm; // per-frame pixel engine, see Function::algorithm
+  bool antialiasing;    // this frame runs phase 5
+  std::vector<double> aaOffsets; // sub-pixel positions, x and y in [0, 1)
+
+  std::vector<Task*> tiles;
+  std::vector<Tile*> grid; // tiles by position, gridw per row (phase 5)
+  int gridw;
+};
+
+/******************************** EOF ***********************************/
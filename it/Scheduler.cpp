@@ -0,0 +1,123 @@
+#include "Scheduler.h"
+#include <algorithm>
+
+Scheduler::Scheduler(int workers) {
+  if (workers < 1) workers = 1;
+  nworkers = workers;
+  for (int p = 0; p < SCHEDULER_PHASES; p++) counts[p] = 0;
+  queued = 0;
+  running = 0;
+  next = 0;
+  cancelled = false;
+  sleeping = 0;
+  quit = false;
+  for (int i = 0; i < workers; i++) queues.push_back(new Queue());
+  for (int i = 0; i < workers; i++) threads.emplace_back(&Scheduler::work, this, i);
+}
+
+Scheduler::~Scheduler() {
+  cancel();
+  {
+    std::lock_guard<std::mutex> lock(idlelock);
+    quit = true;
+  }
+  idle.notify_all();
+  for (std::thread &t: threads) t.join();
+  for (Queue *q: queues) delete q;
+}
+
+void Scheduler::push(int worker, Task *task) {
+  int p = std::min(std::max(task->phase, 0), SCHEDULER_PHASES - 1);
+  Queue *q = queues[worker];
+  std::lock_guard<std::mutex> lock(q->lock);
+  q->tasks[p].push_back(task);
+  counts[p]++;
+  queued++;
+}
+
+void Scheduler::wake(bool all) {
+  if (sleeping.load() == 0) return;
+  { std::lock_guard<std::mutex> lock(idlelock); }
+  if (all) idle.notify_all(); else idle.notify_one();
+}
+
+void Scheduler::submit(Task *task) {
+  push(next++ % workers(), task);
+  wake(false);
+}
+
+void Scheduler::submit(const std::vector<Task*> &tasks) {
+  int n = workers();
+  int i = next;
+  for (Task *task: tasks) push(i++ % n, task);
+  next = i;
+  wake(true);
+}
+
+// Lowest phase first; own deque from the front, others' from the back.
+// running is raised before queued drops, so wait() never sees a gap.
+Task *Scheduler::take(int me) {
+  int n = workers();
+  for (int p = 0; p < SCHEDULER_PHASES; p++) {
+    if (counts[p].load() == 0) continue;
+    for (int k = 0; k < n; k++) {
+      Queue *q = queues[(me + k) % n];
+      std::lock_guard<std::mutex> lock(q->lock);
+      std::deque<Task*> &d = q->tasks[p];
+      if (d.empty()) continue;
+      Task *task;
+      if (k == 0) { task = d.front(); d.pop_front(); }
+      else { task = d.back(); d.pop_back(); }
+      running++;
+      counts[p]--;
+      queued--;
+      return task;
+    }
+  }
+  return nullptr;
+}
+
+void Scheduler::work(int me) {
+  for (;;) {
+    Task *task = take(me);
+    if (task) {
+      bool again = task->run();
+      if (again && !cancelled.load()) {
+        push(me, task);
+        wake(false); // let an idle worker steal what we still have queued
+      }
+      if (--running == 0 && queued.load() == 0) {
+        std::lock_guard<std::mutex> lock(idlelock);
+        done.notify_all();
+      }
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(idlelock);
+    sleeping++;
+    idle.wait(lock, [this] { return quit || queued.load() > 0; });
+    sleeping--;
+    if (quit) return;
+  }
+}
+
+void Scheduler::cancel() {
+  cancelled = true;
+  for (Queue *q: queues) {
+    std::lock_guard<std::mutex> lock(q->lock);
+    for (int p = 0; p < SCHEDULER_PHASES; p++) {
+      int n = (int)q->tasks[p].size();
+      q->tasks[p].clear();
+      counts[p] -= n;
+      queued -= n;
+    }
+  }
+  wait();
+  cancelled = false;
+}
+
+void Scheduler::wait() {
+  std::unique_lock<std::mutex> lock(idlelock);
+  done.wait(lock, [this] { return queued.load() == 0 && running.load() == 0; });
+}
+
+/******************************** EOF ***********************************/
@@ -0,0 +1,64 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+///////////////////////////////////////////////////////////////////////////////
+// Work-stealing scheduler for render tasks.
+//
+// Every worker owns one deque per phase. A worker always takes the lowest
+// phase it can find, first from its own deque (front), then by stealing from
+// the other workers (back). That way all coarse previews of an image are done
+// before any tile starts its full computation, while no core sits idle.
+// A task that returns true from run() is requeued on the running worker's
+// own deque under its (updated) phase, so per-task phase order is kept.
+// Tasks are not owned by the scheduler.
+///////////////////////////////////////////////////////////////////////////////
+
+#define SCHEDULER_PHASES 8
+
+class Task {
+public:
+  int phase;                 // 0..SCHEDULER_PHASES-1, lower runs first
+  Task() { phase = 0; }
+  virtual ~Task() {}
+  virtual bool run() = 0;    // return true to be queued again
+};
+
+class Scheduler {
+public:
+  Scheduler(int workers);
+  ~Scheduler();
+  void submit(Task *task);
+  void submit(const std::vector<Task*> &tasks); // spread over all workers
+  void cancel();             // drop queued tasks, wait for running ones
+  void wait();               // block until nothing is queued or running
+  int workers() { return nworkers; }
+private:
+  struct Queue {
+    std::mutex lock;
+    std::deque<Task*> tasks[SCHEDULER_PHASES];
+  };
+  void work(int me);
+  Task *take(int me);
+  void push(int worker, Task *task);
+  void wake(bool all);
+  int nworkers;
+  std::vector<std::thread> threads;
+  std::vector<Queue*> queues;
+  std::atomic<int> counts[SCHEDULER_PHASES]; // queued tasks per phase
+  std::atomic<int> queued;   // queued tasks, all phases
+  std::atomic<int> running;  // tasks being run right now
+  std::atomic<int> next;     // round robin for submits from outside
+  std::atomic<bool> cancelled;
+  std::atomic<int> sleeping; // workers waiting for work
+  bool quit;
+  std::mutex idlelock;
+  std::condition_variable idle;  // workers wait here for work
+  std::condition_variable done;  // wait() waits here
+};
+
+/******************************** EOF ***********************************/
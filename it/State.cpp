@@ -16,6 +16,12 @@ GNU General Public License for more details.
 #include "State.h"
 #include "Function.h"
 #include "Colormap.h"
+#include <new>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
 //#include "Util.h"
 //#include "Gif.h"
 
@@ -29,41 +35,41 @@ GNU General Public License for more details.
 #define MIN(A,B) ((A)<(B)?(A):(B))
 #define MAX(A,B) ((A)>(B)?(A):(B))
 
-State::State(Function *function, Colormap *colormap, int w, int h) {
+State::State(Function *function, Colormap *colormap, int w, int h, PixelFormat format, int tilesize) {
   this->function = function;
   this->colormap = colormap;
+  this->format = format;
+  this->tilesize = tilesize;
   pix = nullptr;
   pixset = nullptr;
+  tilesx = blocksize = maskoffset = dirtyoffset = 0;
+  bytes = 0;
+  aan = 0;
   width = height = 0;
   selx = sely = selX = selY = 0;
   xres = yres = 0;
+  setRange(0, 1, 0, 1);
   maxDebug = 256;
   resize(w, h);
 }
 
 State::~State() {
-  if (pix) delete [] pix;
-  if (pixset) delete [] pixset;
+  release();
 }
 
 void State::clear() {
-  int n = width * height;
   selx = sely = selX = selY = 0;
-  if (pix) {
-    for (int i = 0; i < n; i++) {
-      pix[i] = 0;
-      pixset[i] = false;
-    }
-  }
+  if (pix) memset(pix, 0, bytes); // also clears the masks
+  if (pixset) memset(pixset, 0, (size_t)width * height);
+  for (int b = 0; pix && b < blocks(); b++) dirtyword(b)->store(1, std::memory_order_relaxed);
+  aaindex.clear();
+  aavalues.clear();
 }
 
 void State::resize(int w, int h) {
   if (pix) {
     if (width != w || height != h) {
-      delete [] pix;
-      delete [] pixset;
-      pix = nullptr;
-      pixset = nullptr;
+      release();
     } else {
       clear();
       return;
@@ -73,17 +79,145 @@ void State::resize(int w, int h) {
   height = h;
   xres = w;
   yres = h;
-  int n = width * height;
-  pix = new double[n];
-  pixset = new bool[n];
+  allocate();
+}
+
+void State::setStorage(PixelFormat f, int t) {
+  if (t < 0) t = 0;
+  if (f == format && t == tilesize && pix) return;
+  release();
+  format = f;
+  tilesize = t;
+  allocate();
+}
+
+/*static*/ PixelFormat State::getPixelFormatByName(const std::string &name) {
+  if (name == "float") return PIX_FLOAT;
+  else if (name == "uint16") return PIX_UINT16;
+  else if (name == "rgb32") return PIX_RGB32;
+  else return PIX_DOUBLE;
+}
+
+size_t State::memoryUsed() {
+  return bytes + (pixset ? (size_t)width * height : 0);
+}
+
+// samples per pixel, sampled pixels, pix, pixset, sample indices, values
+size_t State::frameSize() {
+  return 2 * sizeof(int32_t) + memoryUsed() + aaindex.size() * sizeof(int) + aavalues.size() * sizeof(double);
+}
+
+void State::writeFrame(byte *out) {
+  int32_t head[2] = { aan, (int32_t)aaindex.size() };
+  memcpy(out, head, sizeof(head));
+  out += sizeof(head);
+  memcpy(out, pix, bytes);
+  out += bytes;
+  if (pixset) {
+    memcpy(out, pixset, (size_t)width * height);
+    out += (size_t)width * height;
+  }
+  memcpy(out, aaindex.data(), aaindex.size() * sizeof(int));
+  memcpy(out + aaindex.size() * sizeof(int), aavalues.data(), aavalues.size() * sizeof(double));
+}
+
+bool State::readFrame(const byte *in, size_t n) {
+  int32_t head[2];
+  if (n < sizeof(head)) return false;
+  memcpy(head, in, sizeof(head));
+  if (pix == nullptr) allocate();
+  size_t count = head[1] < 0 ? 0 : (size_t)head[1];
+  if (head[0] < 0 || n != sizeof(head) + memoryUsed() + count * (sizeof(int) + head[0] * sizeof(double))) return false;
+  in += sizeof(head);
+  memcpy(pix, in, bytes);
+  in += bytes;
+  if (pixset) {
+    memcpy(pixset, in, (size_t)width * height);
+    in += (size_t)width * height;
+  }
+  for (int b = 0; b < blocks(); b++) dirtyword(b)->store(1, std::memory_order_relaxed);
+  std::vector<int> index(count);
+  std::vector<double> values(count * head[0]);
+  memcpy(index.data(), in, count * sizeof(int));
+  memcpy(values.data(), in + count * sizeof(int), values.size() * sizeof(double));
+  setSamples(std::move(index), std::move(values), head[0]);
+  return true;
+}
+
+// Tiled: each tile is a block of tilesize^2 pixels followed by a bitmask of
+// set pixels and a dirty flag, padded to whole cache lines, so tiles never
+// share a line. Row-major: one block, with the dirty flag after the pixels.
+void State::allocate() {
+  pixbytes = format == PIX_DOUBLE ? 8 : format == PIX_UINT16 ? 2 : 4;
+  if (tilesize) {
+    tilesx = (width + tilesize - 1) / tilesize;
+    int tilesy = (height + tilesize - 1) / tilesize;
+    int words = (tilesize * tilesize + 63) / 64;
+    maskoffset = ((tilesize * tilesize * pixbytes + 7) / 8) * 8;
+    dirtyoffset = maskoffset + words * 8;
+    int blockbytes = ((dirtyoffset + 8 + 63) / 64) * 64;
+    blocksize = blockbytes / pixbytes;
+    bytes = (size_t)tilesx * tilesy * blockbytes;
+    pix = (byte *)::operator new[](bytes, std::align_val_t(64));
+    pixset = nullptr;
+    for (int b = 0; b < tilesx * tilesy; b++) {
+      std::atomic<uint64_t> *mask = (std::atomic<uint64_t> *)(pix + (size_t)b * blockbytes + maskoffset);
+      for (int i = 0; i <= words; i++) new (mask + i) std::atomic<uint64_t>(0);
+    }
+  } else {
+    tilesx = 1;
+    dirtyoffset = ((size_t)width * height * pixbytes + 63) / 64 * 64;
+    bytes = dirtyoffset + 64;
+    pix = (byte *)::operator new[](bytes, std::align_val_t(64));
+    pixset = new bool[(size_t)width * height];
+    new (dirtyword(0)) std::atomic<uint64_t>(0);
+  }
   clear();
 }
 
+int State::blocks() {
+  if (tilesize == 0) return 1;
+  return tilesx * ((height + tilesize - 1) / tilesize);
+}
+
+// Whether any pixel of the tile containing x, y was written since the last
+// call. Take before reading the pixels, so no write is missed: the acquire
+// pairs with the release in setPixelAt, so a taken flag shows the pixels.
+bool State::takeDirty(int x, int y) {
+  int block = tilesize ? (y / tilesize) * tilesx + x / tilesize : 0;
+  return dirtyword(block)->exchange(0, std::memory_order_acquire) != 0;
+}
+
+void State::release() {
+  if (pix) ::operator delete[](pix, std::align_val_t(64));
+  if (pixset) delete [] pixset;
+  pix = nullptr;
+  pixset = nullptr;
+  bytes = 0;
+  aaindex.clear();
+  aavalues.clear();
+}
+
 void State::setRange(double x, double X, double y, double Y) {
   xmin = x;
   xmax = X;
   ymin = y;
   ymax = Y;
+  centerx = (qdouble(x) + X) * 0.5;
+  centery = (qdouble(y) + Y) * 0.5;
+  spanx = X - x;
+  spany = Y - y;
+}
+
+void State::setRange(const qdouble &cx, const qdouble &cy, double w, double h) {
+  centerx = cx;
+  centery = cy;
+  spanx = w;
+  spany = h;
+  xmin = (cx - w * 0.5).toDouble();
+  xmax = (cx + w * 0.5).toDouble();
+  ymin = (cy - h * 0.5).toDouble();
+  ymax = (cy + h * 0.5).toDouble();
 }
 
 void State::setSelection(double x, double X, double y, double Y) {
@@ -94,10 +228,7 @@ void State::setSelection(double x, double X, double y, double Y) {
 }
 
 void State::getRangeFromFunction() {
-  xmin = function->defxmin;
-  xmax = function->defxmax;
-  ymin = function->defymin;
-  ymax = function->defymax;
+  setRange(function->defxmin, function->defxmax, function->defymin, function->defymax);
 }
 
 //#define X(P) ((xmax - xmin) * (double)(P) / xres + xmin)
@@ -114,7 +245,21 @@ double State::getYScale() { return (ymax - ymin) / height; }
 double State::X(int x) {
   return xmin + (xmax - xmin) * ((double)x / (width - 1));
 }
+double State::pixelSize() {
+  double px = fabs(spanx) / MAX(width - 1, 1);
+  double py = fabs(spany) / MAX(height - 1, 1);
+  return MIN(px, py);
+}
+// dX: screen x to offset from centerx, 0 -> -spanx/2 and (w-1) -> spanx/2
+double State::dX(double x) {
+  return (x - 0.5 * (width - 1)) * (spanx / (width - 1));
+}
+// dY: screen y to offset from centery, 0 (top) -> spany/2
+double State::dY(double y) {
+  return (0.5 * (height - 1) - y) * (spany / (height - 1));
+}
 // invX: coords to screen s.t. xmin->0 and xmax->w-1
+
 int State::invX(double x) {
   return (int)((width - 1) * ((x - xmin) / (xmax - xmin)));
 }
@@ -134,41 +279,173 @@ int State::invH(double h) {
 }
 
 bool State::isSet(int x, int y) {
-  int index = y * width + x;
-  return pixset[index];
+  return isSetAt(getPixelIndex(x, y));
 }
 bool State::isSetAt(int index) {
-  return pixset[index];
+  if (tilesize == 0) return pixset[index];
+  return (maskword(index)->load(std::memory_order_relaxed) >> ((index % blocksize) & 63)) & 1;
 }
 double State::getPixel(int x, int y) {
-  int index = y * width + x;
-  return pix[index];
+  return getPixelAt(getPixelIndex(x, y));
 }
 int State::getPixelIndex(int x, int y) {
-  return y * width + x;
+  if (tilesize == 0) return y * width + x;
+  int tx = x / tilesize, ty = y / tilesize;
+  return (ty * tilesx + tx) * blocksize + (y - ty * tilesize) * tilesize + (x - tx * tilesize);
+}
+// Number of pixels from x on whose indices are consecutive
+int State::getRunLength(int x) {
+  if (tilesize == 0) return width - x;
+  return MIN(tilesize - x % tilesize, width - x);
 }
 double State::getPixelAt(int index) {
-  return pix[index];
+  switch (format) {
+  case PIX_FLOAT: return unpackFloat(((float *)pix)[index]);
+  case PIX_UINT16: return unpack16(((uint16_t *)pix)[index]);
+  case PIX_RGB32: return unpack32(((uint32_t *)pix)[index]);
+  default: return ((double *)pix)[index];
+  }
 }
 void State::setPixel(int x, int y, double col, bool set) {
   if (x < 0 || x >= width || y < 0 || y >= height) return; // keep!
-  int index = y * width + x;
-  if (set) pixset[index] = true;
+  int index = getPixelIndex(x, y);
   if (col > 1.0) col /= 255.0;
-  pix[index] = col;
+  setPixelAt(index, col, set);
 }
 void State::setPixelAt(int index, double col, bool set) {
-  if (set) pixset[index] = true;
-  pix[index] = col;
+  switch (format) {
+  case PIX_FLOAT: ((float *)pix)[index] = packFloat(col); break;
+  case PIX_UINT16: ((uint16_t *)pix)[index] = pack16(col); break;
+  case PIX_RGB32: ((uint32_t *)pix)[index] = pack32(col); break;
+  default: ((double *)pix)[index] = col; break;
+  }
+  int block = tilesize ? index / blocksize : 0;
+  // Always store: skipping it when the flag still reads 1 can miss a
+  // takeDirty that has already cleared it, and the pixel stays stale.
+  dirtyword(block)->store(1, std::memory_order_release);
+  if (!set) return;
+  if (tilesize == 0) pixset[index] = true;
+  else maskword(index)->fetch_or((uint64_t)1 << ((index % blocksize) & 63), std::memory_order_relaxed);
 }
 void State::setPixelRegion(int x, int y, double col, int w, int h) {
-  int index = y * width + x;
-  pixset[index] = true; // only set top left pixel
+  setPixelAt(getPixelIndex(x, y), col); // only set top left pixel
+  for (int j = y; j < y + h; j++) {
+    for (int i = x; i < x + w; ) {
+      int index = getPixelIndex(i, j);
+      int n = MIN(getRunLength(i), x + w - i);
+      for (int k = 0; k < n; k++) if (!isSetAt(index + k)) setPixelAt(index + k, col, false);
+      i += n;
+    }
+  }
+}
+void State::mapPixels(int index, int n, Colormap *map, uint32_t *out) {
+  switch (format) {
+  case PIX_FLOAT: {
+      const float *p = (const float *)pix + index;
+      for (int i = 0; i < n; i++) out[i] = map->getColorFloat(p[i]);
+      break;
+    }
+  case PIX_UINT16: {
+      const uint16_t *p = (const uint16_t *)pix + index;
+      for (int i = 0; i < n; i++) out[i] = map->getColor16(p[i]);
+      break;
+    }
+  case PIX_RGB32: {
+      const uint32_t *p = (const uint32_t *)pix + index;
+      for (int i = 0; i < n; i++) out[i] = map->getColor32(p[i]);
+      break;
+    }
+  default: {
+      const double *p = (const double *)pix + index;
+      for (int i = 0; i < n; i++) out[i] = map->getColor(p[i]);
+      break;
+    }
+  }
+  if (aaindex.empty()) return;
+  auto it = std::lower_bound(aaindex.begin(), aaindex.end(), index);
+  for (; it != aaindex.end() && *it < index + n; ++it) {
+    const double *v = aavalues.data() + (size_t)(it - aaindex.begin()) * aan;
+    uint32_t c = out[*it - index];
+    uint32_t r = (c >> 16) & 0xff, g = (c >> 8) & 0xff, b = c & 0xff;
+    for (int k = 0; k < aan; k++) {
+      c = map->getColor(v[k]);
+      r += (c >> 16) & 0xff;
+      g += (c >> 8) & 0xff;
+      b += c & 0xff;
+    }
+    int m = aan + 1;
+    out[*it - index] = 0xff000000u | ((r + m / 2) / m) << 16 | ((g + m / 2) / m) << 8 | (b + m / 2) / m;
+  }
+}
+
+void State::setSamples(std::vector<int> &&index, std::vector<double> &&values, int n) {
+  aaindex = std::move(index);
+  aavalues = std::move(values);
+  aan = n;
+  for (int i: aaindex) dirtyword(tilesize ? i / blocksize : 0)->store(1, std::memory_order_release);
+}
+
+void State::setPixelRow(int x, int y, const double *cols, int n) {
+  for (int i = 0; i < n; ) {
+    int index = getPixelIndex(x + i, y);
+    int m = MIN(getRunLength(x + i), n - i);
+    for (int k = 0; k < m; k++) setPixelAt(index + k, cols[i + k]);
+    i += m;
+  }
+}
+
+// Only valid for the same function and arguments. Positions are computed from
+// the difference of the centers, so this works at any depth.
+int State::seedFrom(State *prev, double tolerance) {
+  if (prev == nullptr || prev->function != function || prev->pspace != pspace || prev->hash != hash) return 0;
+  if (width < 2 || height < 2 || prev->width < 2 || prev->height < 2) return 0;
+  double psx = prev->spanx / (prev->width - 1), psy = prev->spany / (prev->height - 1);
+  double sx = spanx / (width - 1), sy = spany / (height - 1);
+  double ox = (centerx - prev->centerx).toDouble(), oy = (centery - prev->centery).toDouble();
+  std::vector<int> px(width, -1), py(height, -1);
+  for (int x = 0; x < width; x++) {
+    double f = (ox + dX(x)) / psx + 0.5 * (prev->width - 1);
+    double r = floor(f + 0.5);
+    if (r >= 0 && r < prev->width && fabs(f - r) * psx <= tolerance * sx) px[x] = (int)r;
+  }
+  for (int y = 0; y < height; y++) {
+    double f = 0.5 * (prev->height - 1) - (oy + dY(y)) / psy;
+    double r = floor(f + 0.5);
+    if (r >= 0 && r < prev->height && fabs(f - r) * psy <= tolerance * sy) py[y] = (int)r;
+  }
+  int seeded = 0;
+  for (int y = 0; y < height; y++) {
+    if (py[y] < 0) continue;
+    for (int x = 0; x < width; x++) {
+      if (px[x] < 0) continue;
+      int pidx = prev->getPixelIndex(px[x], py[y]);
+      if (!prev->isSetAt(pidx)) continue;
+      setPixelAt(getPixelIndex(x, y), prev->getPixelAt(pidx));
+      seeded++;
+    }
+  }
+  return seeded;
+}
+
+bool State::isRegionSet(int x, int y, int w, int h) {
   for (int j = y; j < y + h; j++) {
     for (int i = x; i < x + w; i++) {
-      pix[j * width + i] = col;
+      if (!isSet(i, j)) return false;
     }
   }
+  return true;
+}
+
+void State::getRegion(int x, int y, int w, int h, double *out) {
+  for (int j = y; j < y + h; j++) {
+    for (int i = x; i < x + w; i++) *out++ = getPixel(i, j);
+  }
+}
+
+void State::setRegion(int x, int y, int w, int h, const double *in) {
+  for (int j = y; j < y + h; j++) {
+    for (int i = x; i < x + w; i++) setPixelAt(getPixelIndex(i, j), *in++);
+  }
 }
 
 void State::drawLine(int x, int y, int tx, int ty, byte col) {
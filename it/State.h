@@ -19,6 +19,9 @@
 #include <vector>
 #include <unordered_map>
 #include <mutex>
+#include <atomic>
+#include <stdint.h>
+#include "MTQuad.h"
 
 // SETPIXEL(x, y, color) -- set a pixel corresponding to real coordinates x, y
 // SETPIXEL_(x, y, color) -- set a pixel in image coordinates (0, 0) is lower left
@@ -43,12 +46,67 @@ class Colormap;
 class Annotation;
 typedef unsigned char byte;
 
+/*
+ * How State stores a pixel. All formats keep the RGB pixels of
+ * Function::rgb (sign bit set, 0xffRRGGBB); Colormap decodes each directly.
+ *   PIX_DOUBLE  8 bytes, exactly what iterate_ returned
+ *   PIX_FLOAT   4 bytes, float; RGB as -(1 + 0xRRGGBB)
+ *   PIX_UINT16  2 bytes, [0,1] in 15 bits; RGB as 0x8000 | RGB555
+ *   PIX_RGB32   4 bytes, [0,1] in 24 bits; RGB as 0xffRRGGBB
+ */
+enum PixelFormat { PIX_DOUBLE, PIX_FLOAT, PIX_UINT16, PIX_RGB32 };
+
+inline bool isRGB(double x) {
+  union { double d; uint64_t i; } u;
+  u.d = x;
+  return (u.i >> 63) != 0;
+}
+inline uint32_t rgbOf(double x) {
+  union { double d; uint64_t i; } u;
+  u.d = x;
+  return (uint32_t)u.i & 0xffffffu;
+}
+inline double rgbPixel(uint32_t rgb) {
+  union { double d; uint64_t i; } u;
+  u.i = 0x80000000ff000000ull | (rgb & 0xffffffu);
+  return u.d;
+}
+inline double clamp01(double x) { return x > 0.0 ? (x < 1.0 ? x : 1.0) : 0.0; }
+
+inline float packFloat(double x) { return isRGB(x) ? -(1.0f + (float)rgbOf(x)) : (float)x; }
+inline double unpackFloat(float f) { return f < 0.0f ? rgbPixel((uint32_t)(-f) - 1) : (double)f; }
+inline uint16_t pack16(double x) {
+  if (!isRGB(x)) return (uint16_t)(clamp01(x) * 32767.0 + 0.5);
+  uint32_t c = rgbOf(x);
+  return (uint16_t)(0x8000 | ((c >> 9) & 0x7c00) | ((c >> 6) & 0x03e0) | ((c >> 3) & 0x001f));
+}
+inline double unpack16(uint16_t q) {
+  if ((q & 0x8000) == 0) return q / 32767.0;
+  uint32_t r = (q >> 10) & 31, g = (q >> 5) & 31, b = q & 31;
+  return rgbPixel((((r << 3) | (r >> 2)) << 16) | (((g << 3) | (g >> 2)) << 8) | ((b << 3) | (b >> 2)));
+}
+inline uint32_t pack32(double x) {
+  return isRGB(x) ? 0xff000000u | rgbOf(x) : (uint32_t)(clamp01(x) * 16777215.0 + 0.5);
+}
+inline double unpack32(uint32_t p) {
+  return (p >> 24) ? rgbPixel(p) : (p & 0xffffffu) / 16777215.0;
+}
+
 class State {
 public:
-  State(Function *function, Colormap *colormap, int w, int h);
+  State(Function *function, Colormap *colormap, int w, int h,
+        PixelFormat format = PIX_DOUBLE, int tilesize = 0);
   ~State();
   void resize(int w, int h);
+  // Storage layout; reallocates (and clears) only if it changes
+  void setStorage(PixelFormat format, int tilesize);
+  void setTiling(int tilesize) { setStorage(format, tilesize); } // 0: row-major
+  void setPixelFormat(PixelFormat f) { setStorage(f, tilesize); }
+  PixelFormat getPixelFormat() { return format; }
+  static PixelFormat getPixelFormatByName(const std::string &name);
+  size_t memoryUsed();
   void setRange(double x, double X, double y, double Y);
+  void setRange(const qdouble &cx, const qdouble &cy, double w, double h);
   void setSelection(double x, double X, double y, double Y);
   void getRangeFromFunction();
   void clear();
@@ -62,15 +120,46 @@ public:
   int invY(double y);
   int invW(double w);
   int invH(double h);
+  // Offset of (fractional) pixel x/y from the center, exact for any zoom
+  double dX(double x);
+  double dY(double y);
+  qdouble qX(double x) { return centerx + dX(x); }
+  qdouble qY(double y) { return centery + dY(y); }
+  double pixelSize();     // spacing of the sample points (the smaller one)
 
+  // Pixel indices are only contiguous for getRunLength(x) pixels of a row
   bool isSet(int x, int y);
   bool isSetAt(int index);
   double getPixel(int x, int y);
   int getPixelIndex(int x, int y);
+  int getRunLength(int x);
   double getPixelAt(int index);
   void setPixel(int x, int y, double col, bool set=true);
   void setPixelAt(int index, double col, bool set=true);
   void setPixelRegion(int x, int y, double col, int w, int h);
+  void setPixelRow(int x, int y, const double *cols, int n);
+  // Colors of n pixels with consecutive indices, decoded directly
+  void mapPixels(int index, int n, Colormap *map, uint32_t *out);
+  bool takeDirty(int x, int y);
+  // Copy the set pixels of prev whose sample points lie within tolerance
+  // (in our pixels) of ours; returns the number of pixels seeded
+  int seedFrom(State *prev, double tolerance);
+  // Rectangles of pixel values, row by row; setRegion marks them set
+  bool isRegionSet(int x, int y, int w, int h);
+  void getRegion(int x, int y, int w, int h, double *out);
+  void setRegion(int x, int y, int w, int h, const double *in);
+  // Supersamples of edge pixels (see Renderer::aaSamples): n values per pixel,
+  // by increasing index; mapPixels averages their colors with the pixel's
+  void setSamples(std::vector<int> &&index, std::vector<double> &&values, int n);
+  int countSamples() { return (int)aaindex.size(); }
+  // Pixels, set masks and samples as one blob (see RenderCache, History);
+  // readFrame needs the same size, format and tiling, and marks everything
+  // dirty. Without its frame a State keeps only range and arguments.
+  size_t frameSize();
+  void writeFrame(byte *out);
+  bool readFrame(const byte *in, size_t n);
+  void releaseFrame() { release(); }
+  bool hasFrame() { return pix != nullptr; }
 
   void drawLine(int x, int y, int tx, int ty, byte col);
   void setColormap(Colormap *map);
@@ -78,6 +167,8 @@ public:
   void unsetColors();
   int getWidth() { return width; }
   int getHeight() { return height; }
+  int getTileWidth() { return tilesize ? tilesize : width; }
+  int getTileHeight() { return tilesize ? tilesize : height; }
   void storeArgs(Function *function);
   void restoreArgs(Function *function);
   Function *function;     /* Pointer to function */
@@ -88,6 +179,9 @@ public:
   //bool saveEPS(const char *filename, Colormap *colormap);
 public:
   double xmin, xmax, ymin, ymax; /* image region in real coordinates */
+  qdouble centerx, centery;      /* the same region in full precision: */
+  double spanx, spany;           /* center, width and height */
+
   double selx, sely, selX, selY; /* selection in real coordinates */
   double xres, yres;             /* image resolution */
   bool annnotate;                /* allow annotations (TODO: here?) */
@@ -111,8 +205,31 @@ private:
   std::unordered_map<std::string,std::string> hash;/* hash to store all arguments */
   int width;              /* image width */
   int height;             /* image height */
-  double *pix;            /* cached pixels: raw values as returned from iterate */
-  bool *pixset;           /* remember if a pixel is set */
+  byte *pix;              /* cached pixels, encoded as format */
+  bool *pixset;           /* remember if a pixel is set (row-major only) */
+  PixelFormat format;
+  int pixbytes;           /* bytes per pixel */
+  int tilesize;           /* 0 or tile edge: one cache-aligned block per tile */
+  int tilesx;             /* tiles per row */
+  int blocksize;          /* pixel slots per block: pixels, then a set-bitmask */
+  int maskoffset;         /* byte offset of the bitmask in a block */
+  size_t dirtyoffset;     /* byte offset of the dirty flag in a block */
+  size_t bytes;           /* size of pix */
+  void allocate();
+  void release();
+  int blocks();
+  std::atomic<uint64_t> *dirtyword(int block) {
+    return (std::atomic<uint64_t> *)(pix + (size_t)block * blocksize * pixbytes + dirtyoffset);
+  }
+  std::vector<int> aaindex;       /* supersampled pixels, sorted */
+  std::vector<double> aavalues;   /* aan values for each */
+  int aan;
+  std::atomic<uint64_t> *maskword(int index) {
+    int block = index / blocksize;
+    int local = index - block * blocksize;
+    return (std::atomic<uint64_t> *)(pix + (size_t)block * blocksize * pixbytes + maskoffset) + (local >> 6);
+  }
+
   int *mapped;            // tmp
 public:
   void start();
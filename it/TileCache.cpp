@@ -0,0 +1,70 @@
+#include "TileCache.h"
+#include "State.h"
+#include <math.h>
+
+bool TileGrid::operator == (const TileGrid &g) const {
+  return ax == g.ax && ay == g.ay && sx == g.sx && sy == g.sy && tilesize == g.tilesize && scene == g.scene;
+}
+
+void TileGrid::window(int level, long long x0, long long y0, int w, int h, qdouble &cx, qdouble &cy, double &sw, double &sh) const {
+  double px = ldexp(sx, -level), py = ldexp(sy, -level);
+  // x0 * px is exact in quad-double for any x0 below 2^53
+  cx = ax + qdouble((double)x0) * px + 0.5 * (w - 1) * px;
+  cy = ay - qdouble((double)y0) * py - 0.5 * (h - 1) * py;
+  sw = (w - 1) * px;
+  sh = (h - 1) * py;
+}
+
+void TileGrid::setRange(State *state, int level, long long x0, long long y0) const {
+  qdouble cx, cy;
+  double sw, sh;
+  window(level, x0, y0, state->getWidth(), state->getHeight(), cx, cy, sw, sh);
+  state->setRange(cx, cy, sw, sh);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+TileCache::TileCache(size_t budget_) {
+  budget = budget_;
+  used = 0;
+}
+
+void TileCache::setBudget(size_t bytes) {
+  budget = bytes;
+  evict();
+}
+
+const std::vector<double> *TileCache::find(const TileKey &key) {
+  auto it = index.find(key);
+  if (it == index.end()) return nullptr;
+  lru.splice(lru.begin(), lru, it->second);
+  return &it->second->second;
+}
+
+void TileCache::insert(const TileKey &key, std::vector<double> &&pixels) {
+  auto it = index.find(key);
+  if (it != index.end()) {
+    used -= it->second->second.size() * sizeof(double);
+    lru.erase(it->second);
+  }
+  used += pixels.size() * sizeof(double);
+  lru.emplace_front(key, std::move(pixels));
+  index[key] = lru.begin();
+  evict();
+}
+
+void TileCache::clear() {
+  lru.clear();
+  index.clear();
+  used = 0;
+}
+
+void TileCache::evict() {
+  while (used > budget && !lru.empty()) {
+    used -= lru.back().second.size() * sizeof(double);
+    index.erase(lru.back().first);
+    lru.pop_back();
+  }
+}
+
+/******************************** EOF ***********************************/
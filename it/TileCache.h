@@ -0,0 +1,66 @@
+#pragma once
+#include <list>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "MTQuad.h"
+
+class State;
+
+///////////////////////////////////////////////////////////////////////////////
+// Pixels of a world-space tile grid, for panning without full rerenders.
+//
+// A TileGrid fixes the world: the sample point of pixel (0, 0), the pixel
+// spacing at level 0 and the tile size. Level k halves the spacing k times,
+// so pixel (i, j) of level k lies at anchor + (i, -j) * spacing / 2^k.
+// A TileCache keeps the pixel values of finished tiles of one grid, keyed by
+// (level, tile x, tile y), and drops the least recently used beyond a budget.
+///////////////////////////////////////////////////////////////////////////////
+
+class TileGrid {
+public:
+  qdouble ax, ay;        // world coordinates of pixel (0, 0)
+  double sx, sy;         // pixel spacing at level 0
+  int tilesize;
+  std::string scene;     // function, space and arguments the pixels belong to
+  TileGrid() { sx = sy = 0; tilesize = 0; }
+  bool operator == (const TileGrid &g) const;
+  bool operator != (const TileGrid &g) const { return !(*this == g); }
+  // Center and span of w x h world pixels of level, from x0, y0 on
+  void window(int level, long long x0, long long y0, int w, int h, qdouble &cx, qdouble &cy, double &sw, double &sh) const;
+  // Set state's range to world pixels x0.. and y0.. of level, state-sized
+  void setRange(State *state, int level, long long x0, long long y0) const;
+};
+
+struct TileKey {
+  int level;
+  long long tx, ty;
+  bool operator == (const TileKey &k) const { return level == k.level && tx == k.tx && ty == k.ty; }
+};
+
+struct TileKeyHash {
+  size_t operator () (const TileKey &k) const {
+    return std::hash<long long>()(k.tx * 0x9e3779b97f4a7c15ULL ^ k.ty) ^ (size_t)k.level;
+  }
+};
+
+class TileCache {
+public:
+  TileCache(size_t budget = (size_t)256 << 20);
+  void setBudget(size_t bytes);
+  size_t memoryUsed() { return used; }
+  // Pixels of a tile, row by row, or nullptr; marks the tile recently used
+  const std::vector<double> *find(const TileKey &key);
+  bool contains(const TileKey &key) { return index.count(key) != 0; }
+  void insert(const TileKey &key, std::vector<double> &&pixels);
+  void clear();
+private:
+  typedef std::list<std::pair<TileKey, std::vector<double>>> LRU;
+  LRU lru;               // front: most recently used
+  std::unordered_map<TileKey, LRU::iterator, TileKeyHash> index;
+  size_t budget;
+  size_t used;
+  void evict();
+};
+
+/******************************** EOF ***********************************/
@@ -0,0 +1,331 @@
+// Renders one image without a display, for batch jobs and parameter sweeps.
+//
+// usage: it-render [options] <function>
+//   <function> is a compiled function library (as built by compile_*.sh,
+//   e.g. ~/It/build/mandel3.so), a formula (a function file starting with
+//   "#formula", see Formula.h) or the name of a builtin ("Sample Quadratic").
+//
+//   it-render -s 4000 -c hot -o mandel.png "Sample Quadratic"
+//   it-render -r -0.75,-0.74,0.1,0.11 -p depth=5000 -o a.raw build/mandel3.so
+//   it-render -s 40000 -o poster.tif "Sample Quadratic"
+//
+// PNG and TIFF output is colormapped (and antialiased with --aa); raw output
+// is the pixel values as native doubles, row by row (NaN-encoded colors as
+// described in Function.h).
+//
+// Posters (over POSTER_PIXELS, or with --band) are rendered in horizontal
+// bands that are colormapped and streamed to the file while the next band
+// renders, so only two bands are ever in memory.
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QLibrary>
+#include <QImage>
+#include <QColorSpace>
+#include <QThread>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "Function.h"
+#include "Formula.h"
+#include "State.h"
+#include "Colormap.h"
+#include "Render.h"
+#include "imagestream.h"
+
+#define DEFAULT_COLORMAP "hot"
+#define POSTER_PIXELS (64 << 20) // larger images render in bands
+#define BAND_TILES 4             // default band height, in tiles
+
+typedef Function *(*CreateFunction)(int pspace);
+
+static int fail(const QString &msg) {
+  fprintf(stderr, "it-render: %s\n", qPrintable(msg));
+  return 1;
+}
+
+// Both spaces of a function, linked through other; nullptr on failure
+static Function *loadFunction(const QString &name, QString &error) {
+  if (!QFileInfo::exists(name)) {
+    Function *f = createBuiltinFunction(name.toStdString());
+    if (f == nullptr) error = QString("no such file or builtin function: %1").arg(name);
+    return f;
+  }
+  QFile file(name);
+  if (file.open(QIODevice::ReadOnly) && Formula::isFormula(file.peek(256).toStdString())) {
+    std::string message;
+    Function *f = createFormulaFunction(file.readAll().toStdString(), message);
+    if (f == nullptr) error = QString::fromStdString(message);
+    return f;
+  }
+  QLibrary *dylib = new QLibrary(QFileInfo(name).absoluteFilePath()); // never unloaded
+  if (!dylib->load()) {
+    error = dylib->errorString();
+    return nullptr;
+  }
+  CreateFunction createfun = (CreateFunction)dylib->resolve("_createFunction");
+  if (createfun == nullptr) {
+    error = QString("could not resolve _createFunction in %1").arg(name);
+    return nullptr;
+  }
+  Function *f = createfun(1); // param space first
+  f->other = createfun(0);    // dyn space is other
+  f->other->other = f;
+  return f;
+}
+
+static Colormap *loadColormap(const QString &name) {
+  Colormap *colormap = Colormap::getColormapByName(name.toStdString());
+  if (colormap == nullptr && QFileInfo::exists(name)) {
+    colormap = new Colormap();
+    colormap->load(name.toStdString());
+  }
+  return colormap;
+}
+
+static void mapRow(State *state, Colormap *colormap, int y, uint32_t *line) {
+  int w = state->getWidth();
+  for (int x = 0; x < w; ) {
+    int n = std::min(state->getRunLength(x), w - x);
+    state->mapPixels(state->getPixelIndex(x, y), n, colormap, line + x);
+    x += n;
+  }
+}
+
+static bool writePNG(State *state, Colormap *colormap, const QString &file) {
+  int h = state->getHeight();
+  QImage image(state->getWidth(), h, QImage::Format_RGB32);
+  image.setColorSpace(QColorSpace::SRgb);
+  for (int y = 0; y < h; y++) mapRow(state, colormap, y, (uint32_t *)image.scanLine(y));
+  return image.save(file, "PNG");
+}
+
+static bool writeRawRows(State *state, FILE *fp) {
+  int w = state->getWidth();
+  std::vector<double> row(w);
+  bool ok = true;
+  for (int y = 0; ok && y < state->getHeight(); y++) {
+    for (int x = 0; x < w; x++) row[x] = state->getPixel(x, y);
+    ok = fwrite(row.data(), sizeof(double), w, fp) == (size_t)w;
+  }
+  return ok;
+}
+
+static bool writeRaw(State *state, const QString &file) {
+  FILE *fp = fopen(file.toLocal8Bit().constData(), "wb");
+  if (fp == nullptr) return false;
+  bool ok = writeRawRows(state, fp);
+  return fclose(fp) == 0 && ok;
+}
+
+static State *newState(Function *function, Colormap *colormap, int w, int h, PixelFormat format, int tilesize) {
+  State *state = new State(function, colormap, w, h, format, tilesize);
+  state->setColormap(colormap);
+  state->storeArgs(function);
+  state->pspace = function->pspace;
+  state->clear();
+  return state;
+}
+
+// Poster: band k + 1 renders while band k is written. Returns the number of
+// antialiased pixels, or -1 with error set.
+static int renderBands(Renderer &renderer, Function *function, Colormap *colormap, PixelFormat format,
+                       const qdouble &cx, const qdouble &cy, double w, double h, int xres, int yres,
+                       int band, const QString &file, QString &error) {
+  bool raw = file.endsWith(".raw", Qt::CaseInsensitive);
+  ImageStream *image = nullptr;
+  FILE *fp = nullptr;
+  if (raw) {
+    fp = fopen(file.toLocal8Bit().constData(), "wb");
+    if (fp == nullptr) error = QString("could not write %1").arg(file);
+  } else {
+    std::string e;
+    image = ImageStream::create(file.toLocal8Bit().constData(), xres, yres, e);
+    if (image == nullptr) error = QString::fromStdString(e);
+  }
+  if (fp == nullptr && image == nullptr) return -1;
+
+  band = std::max(2, std::min(band, yres));
+  double py = h / (yres - 1);
+  State *states[2] = {
+    newState(function, colormap, xres, band, format, renderer.tilesize),
+    newState(function, colormap, xres, band, format, renderer.tilesize)
+  };
+  function->state = states[0];
+  function->setColors(); // once: mapping the previous band reads the colormap
+  function->start(false);
+  std::vector<uint32_t> line(xres);
+  bool ok = true;
+  int samples = 0;
+  State *done = nullptr; // rendered, not yet written
+  for (int y0 = 0, k = 0; ok && (y0 < yres || done); ) {
+    State *state = nullptr;
+    int bh = 0;
+    if (y0 < yres) {
+      bh = std::min(band, yres - y0);
+      if (yres - y0 - bh == 1) bh++; // no single-row band at the bottom
+      state = states[k++ & 1];
+      if (state->getHeight() != bh) state->resize(xres, bh);
+      state->clear();
+      state->setRange(cx, cy + qdouble(0.5 * (yres - 1) - (y0 + 0.5 * (bh - 1))) * py, w, (bh - 1) * py);
+      function->state = state;
+      renderer.start(function, state);
+    }
+    if (done) {
+      if (raw) ok = writeRawRows(done, fp);
+      for (int y = 0; !raw && ok && y < done->getHeight(); y++) {
+        mapRow(done, colormap, y, line.data());
+        ok = image->writeRow(line.data());
+      }
+      samples += done->countSamples();
+      done = nullptr;
+    }
+    if (state) {
+      renderer.wait();
+      renderer.finish();
+      done = state;
+      y0 += bh;
+    }
+  }
+  if (!ok) renderer.stop();
+  if (raw) ok = fclose(fp) == 0 && ok;
+  else ok = image->close() && ok;
+  delete image;
+  delete states[0];
+  delete states[1];
+  if (!ok) {
+    error = QString("could not write %1").arg(file);
+    return -1;
+  }
+  return samples;
+}
+
+int main(int argc, char *argv[]) {
+  QCoreApplication app(argc, argv);
+  app.setApplicationName("it-render");
+  app.setOrganizationName("Mannes Technology");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Render an It function to a PNG, TIFF or raw file.");
+  parser.addHelpOption();
+  parser.addPositionalArgument("function", "Compiled function library, formula file, or the name of a builtin function.");
+  QCommandLineOption outputOpt({"o", "output"}, "Output file, .png, .tif or .raw (default it.png).", "file", "it.png");
+  QCommandLineOption sizeOpt({"s", "size"}, "Width, or WIDTHxHEIGHT (default 1000; height follows the range).", "size", "1000");
+  QCommandLineOption rangeOpt({"r", "range"}, "Window as xmin,xmax,ymin,ymax (default: the function's).", "range");
+  QCommandLineOption centerOpt("center", "Window as cx,cy,width, height from the aspect; full precision.", "center");
+  QCommandLineOption paramOpt({"p", "param"}, "Set a parameter, e.g. depth=500 or C=0.25,0. Repeatable.", "name=value");
+  QCommandLineOption colormapOpt({"c", "colormap"}, "Colormap name or file (default " DEFAULT_COLORMAP ").", "map", DEFAULT_COLORMAP);
+  QCommandLineOption dynOpt({"d", "dynamical"}, "Render the dynamical space instead of parameter space.");
+  QCommandLineOption threadsOpt({"j", "threads"}, "Worker threads (default: all cores).", "n");
+  QCommandLineOption aaOpt("aa", "Antialias: supersample edge pixels with n samples each (default 0, off).", "n", "0");
+  QCommandLineOption aaThresholdOpt("aa-threshold", "Value difference that makes an edge (default 0.02).", "t", "0.02");
+  QCommandLineOption bandOpt("band", "Render and stream bands of n rows (default: images over 64M pixels, .tif).", "rows");
+  QCommandLineOption formatOpt("format", "Pixel storage: double, float, uint16 or rgb32 (default double).", "format", "double");
+  QCommandLineOption quietOpt({"q", "quiet"}, "Do not report timing.");
+  parser.addOptions({outputOpt, sizeOpt, rangeOpt, centerOpt, paramOpt, colormapOpt, dynOpt, threadsOpt, aaOpt, aaThresholdOpt, bandOpt, formatOpt, quietOpt});
+  parser.process(app);
+
+  if (parser.positionalArguments().size() != 1) parser.showHelp(1);
+  QString error;
+  Function *function = loadFunction(parser.positionalArguments().first(), error);
+  if (function == nullptr) return fail(error);
+  function->defaults();
+  function->other->defaults();
+  if (parser.isSet(dynOpt)) function = function->other;
+
+  for (const QString &p: parser.values(paramOpt)) {
+    int eq = p.indexOf('=');
+    if (eq <= 0) return fail(QString("bad parameter: %1").arg(p));
+    std::string key = p.left(eq).trimmed().toStdString();
+    if (function->args.getArg(key.c_str()) == nullptr) return fail(QString("no such parameter: %1").arg(p.left(eq)));
+    function->setArg(key.c_str(), p.mid(eq + 1).trimmed().toStdString().c_str());
+  }
+
+  Colormap *colormap = loadColormap(parser.value(colormapOpt));
+  if (colormap == nullptr) return fail(QString("no such colormap: %1").arg(parser.value(colormapOpt)));
+
+  // Window: center and span in full precision, as MainWindow::start
+  qdouble cx, cy;
+  double w, h = 0;
+  if (parser.isSet(rangeOpt) || parser.isSet(centerOpt)) {
+    bool center = parser.isSet(centerOpt);
+    QStringList v = parser.value(center ? centerOpt : rangeOpt).split(',');
+    std::vector<qdouble> q;
+    for (const QString &s: v) {
+      bool ok;
+      q.push_back(qdouble::fromString(s.trimmed().toStdString(), &ok));
+      if (!ok) return fail(QString("bad coordinate: %1").arg(s));
+    }
+    if (q.size() != (center ? 3 : 4)) return fail("expected --range xmin,xmax,ymin,ymax or --center cx,cy,width");
+    if (center) {
+      cx = q[0];
+      cy = q[1];
+      w = q[2].toDouble();
+    } else {
+      cx = (q[0] + q[1]) * 0.5;
+      cy = (q[2] + q[3]) * 0.5;
+      w = (q[1] - q[0]).toDouble();
+      h = (q[3] - q[2]).toDouble();
+    }
+  } else {
+    cx = (qdouble(function->defxmin) + function->defxmax) * 0.5;
+    cy = (qdouble(function->defymin) + function->defymax) * 0.5;
+    w = function->defxmax - function->defxmin;
+    h = function->defymax - function->defymin;
+  }
+
+  QStringList size = parser.value(sizeOpt).toLower().split('x');
+  int xres = size[0].toInt();
+  int yres = size.size() > 1 ? size[1].toInt() : (h > 0 ? (int)(xres * h / w) : xres);
+  if (xres <= 0 || yres <= 0 || !(w > 0)) return fail("bad size or range");
+  if (!(h > 0)) h = w * yres / xres;
+
+  int cores = parser.isSet(threadsOpt) ? parser.value(threadsOpt).toInt() : QThread::idealThreadCount();
+  Renderer renderer(cores);
+  renderer.aaSamples = std::max(0, parser.value(aaOpt).toInt());
+  renderer.aaThreshold = parser.value(aaThresholdOpt).toDouble();
+  PixelFormat format = State::getPixelFormatByName(parser.value(formatOpt).toStdString());
+  QString out = parser.value(outputOpt);
+  bool raw = out.endsWith(".raw", Qt::CaseInsensitive);
+  int band = parser.value(bandOpt).toInt();
+  bool tiff = out.endsWith(".tif", Qt::CaseInsensitive) || out.endsWith(".tiff", Qt::CaseInsensitive);
+  if (!parser.isSet(bandOpt) && (tiff || (long long)xres * yres > POSTER_PIXELS)) band = BAND_TILES * renderer.tilesize;
+  if (parser.isSet(bandOpt) && band <= 0) return fail("bad band height");
+
+  QElapsedTimer timer;
+  timer.start();
+  if (band > 0 && yres > 1) {
+    int samples = renderBands(renderer, function, colormap, format, cx, cy, w, h, xres, yres, band, out, error);
+    if (samples < 0) return fail(error);
+    if (!parser.isSet(quietOpt)) {
+      fprintf(stderr, "%s: %dx%d in %.0f ms (%d cores, bands of %d rows", qPrintable(out), xres, yres,
+              timer.nsecsElapsed() / 1e6, renderer.cores, std::min(std::max(2, band), yres));
+      if (renderer.aaSamples > 0) fprintf(stderr, ", %d pixels antialiased", samples);
+      fprintf(stderr, ")\n");
+    }
+    return 0;
+  }
+
+  State *state = newState(function, colormap, xres, yres, format, renderer.tilesize);
+  state->setRange(cx, cy, w, h);
+  function->state = state;
+  function->setColors();
+  function->start(false);
+  renderer.start(function, state);
+  renderer.wait();
+  renderer.finish();
+  double msec = timer.nsecsElapsed() / 1e6;
+
+  if (!(raw ? writeRaw(state, out) : writePNG(state, colormap, out))) return fail(QString("could not write %1").arg(out));
+  if (!parser.isSet(quietOpt)) {
+    fprintf(stderr, "%s: %dx%d in %.0f ms (%d cores", qPrintable(out), xres, yres, msec, renderer.cores);
+    if (renderer.aaSamples > 0) fprintf(stderr, ", %d pixels antialiased", state->countSamples());
+    fprintf(stderr, ")\n");
+  }
+  return 0;
+}
@@ -1,5 +1,4 @@
 #include <QPainter>
-#include <QRunnable>
 #include <QThread>
 #include <QMouseEvent>
 #include <QApplication>
@@ -17,26 +16,48 @@
 #include "itview.h"
 #include "mainwindow.h"
 
+static long long floorDiv(long long a, long long b) {
+  return a / b - ((a % b != 0) && ((a < 0) != (b < 0)));
+}
+
 ItView::ItView(QWidget *parent) : QWidget{parent} {
   annotate = false;
   sandbox = false;
   thumbsize = 100;
   singlethreaded = false;
-  rendering = false;
   selecting = 0;
-  totalPixels = 0;
   zoom = 1.0;
   image = nullptr;
+  function = nullptr;
+  state = nullptr;
+  colormap = nullptr;
   thumbnail = nullptr;
   thumbstate = nullptr;
+  thumbFunction = nullptr;
   thumbing = false;
-  threadPool = QThreadPool::globalInstance();
+  panning = false;
+  panState = nullptr;
+  panLevel = 0;
+  panx = pany = panStatex = panStatey = 0;
   cores = std::max(1, QThread::idealThreadCount());
-  threadPool->setMaxThreadCount(cores);
+  renderer = new Renderer(cores);
+  renderer->finished = [this]() { emit renderFinished(); };
   qDebug() << "Cores:" << cores;
   progressTimer = new QTimer(this);
   connect(progressTimer, &QTimer::timeout, this, &ItView::onProgressTimer);
-  connect(this, &ItView::renderFinished, this, &ItView::onRenderFinished);
+  // queued: Renderer::start reports a fully seeded frame before returning
+  connect(this, &ItView::renderFinished, this, &ItView::onRenderFinished, Qt::QueuedConnection);
+  thumbRenderer = new Renderer(cores);
+  thumbRenderer->tilesize = 16; // small, so that all cores share a thumbnail
+  thumbRenderer->finished = [this]() { emit thumbnailFinished(); };
+  connect(this, &ItView::thumbnailFinished, this, &ItView::onThumbnailFinished, Qt::QueuedConnection);
+  thumbTimer = new QTimer(this);
+  thumbTimer->setInterval(40);
+  connect(thumbTimer, &QTimer::timeout, this, [this]() {
+    if (!thumbRenderer->isRendering()) thumbTimer->stop();
+    mapThumbnail();
+    update();
+  });
   setFocusPolicy(Qt::StrongFocus);
   setMouseTracking(true);
   orbit = 0;
@@ -46,15 +67,26 @@ ItView::ItView(QWidget *parent) : QWidget{parent} {
 }
 
 ItView::~ItView() {
+  deleteThumbnail();
+  delete thumbRenderer;
+  delete renderer;
 }
 
 void ItView::clear() {
+  if (panState) {
+    renderer->stop();
+    if (function) function->state = state;
+    delete panState;
+    panState = nullptr;
+    panning = false;
+  }
+  tileCache.clear(); // the function changes
+  tileGrid = TileGrid();
   if (image) delete image;
   image = nullptr;
   selection = QRect(0, 0, 0, 0);
   function = nullptr;
-  if (thumbnail) delete thumbnail;
-  thumbnail = nullptr;
+  deleteThumbnail();
   points.clear();
   update();
 }
@@ -120,7 +152,7 @@ void ItView::drawContent(QPainter &painter, const QRect &targetRect) {
     painter.drawRect(selection);
   }
 
-  if (rendering.load()) return;
+  if (renderer->isRendering() || panning) return;
 
   if (function)
     drawAnnotations(painter, function->annotations);
@@ -158,13 +190,71 @@ void ItView::drawContent(QPainter &painter, const QRect &targetRect) {
 }
 
 void ItView::deleteThumbnail() {
+  if (thumbRenderer->isRendering()) thumbRenderer->stop();
+  thumbTimer->stop();
+  delete thumbFunction;
+  thumbFunction = nullptr;
   if (thumbnail != nullptr) {
     delete thumbstate; thumbstate = nullptr;
     delete thumbnail; thumbnail = nullptr;
   }
 }
 
+// The dynamical space of the parameter under the mouse, coarse to fine as
+// in a main render; each mouse move drops the stale one. It renders its own
+// instance of function->other, so the shared function is not touched, and
+// waits for a main render (see onRenderFinished) rather than slow it down.
+void ItView::renderThumbnail() {
+  if (function == nullptr || state == nullptr || function->pspace != 1) return;
+  if (renderer->isRendering()) return;
+  extern MainWindow *mainWindow;
+  Function *copied = mainWindow->newInstance(function->other); // with the arguments as they are now
+  if (copied == nullptr) return;
+  if (thumbnail != nullptr && thumbnail->width() != thumbsize) {
+    deleteThumbnail();
+  }
+  thumbRenderer->stop();
+  if (thumbnail == nullptr) {
+    thumbnail = new QImage(thumbsize, thumbsize, QImage::Format_RGB32);
+    thumbnail->fill(Qt::GlobalColor::black);
+    thumbstate = new State(function->other, colormap, thumbsize, thumbsize);
+    thumbstate->getRangeFromFunction();
+    thumbstate->setTiling(thumbRenderer->tilesize);
+  }
+  delete thumbFunction;
+  thumbFunction = copied;
+  thumbFunction->state = thumbstate;
+  thumbFunction->setParameter(state->X(mousex), state->Y(mousey));
+  thumbstate->clear();
+  thumbRenderer->start(thumbFunction, thumbstate, singlethreaded);
+  thumbTimer->start();
+}
+
+void ItView::onThumbnailFinished() {
+  if (!thumbRenderer->finish()) return; // signal from a thumbnail that was restarted
+  thumbTimer->stop();
+  mapThumbnail();
+  update();
+}
+
+void ItView::mapThumbnail() {
+  if (thumbnail == nullptr) return;
+  int w = thumbstate->getWidth();
+  for (int y = 0; y < thumbstate->getHeight(); y++) {
+    uint32_t *line = (uint32_t *)thumbnail->scanLine(y);
+    for (int x = 0; x < w; ) {
+      int n = std::min(thumbstate->getRunLength(x), w - x);
+      thumbstate->mapPixels(thumbstate->getPixelIndex(x, y), n, colormap, line + x);
+      x += n;
+    }
+  }
+}
+
 void ItView::mousePressEvent(QMouseEvent *event) {
+  if (panning) {
+    panMouse = event->pos();
+    return;
+  }
   if (event->button() == Qt::LeftButton) {
     zoom = 1.0;
     pan = QPoint(0, 0);
@@ -191,6 +281,26 @@ void ItView::mousePressEvent(QMouseEvent *event) {
 void ItView::mouseMoveEvent(QMouseEvent *event) {
   mousex = event->pos().x();
   mousey = event->pos().y();
+  if (panning) {
+    if (event->buttons() & Qt::LeftButton) { // drag the view over the world
+      panx -= event->pos().x() - panMouse.x();
+      pany -= event->pos().y() - panMouse.y();
+      panMouse = event->pos();
+      if (panx < panStatex || pany < panStatey ||
+          panx + image->width() > panStatex + panState->getWidth() ||
+          pany + image->height() > panStatey + panState->getHeight()) {
+        renderPan(); // new tiles exposed
+      } else {
+        mapPan();
+        update();
+      }
+    }
+    double x = panState->X((int)(mousex + panx - panStatex));
+    double y = panState->Y((int)(mousey + pany - panStatey));
+    extern MainWindow *mainWindow;
+    mainWindow->statusBar()->showMessage(QString("Mouse position: %1, %2").arg(x).arg(y));
+    return;
+  }
   if ((event->buttons() & Qt::LeftButton)) {
     if (Qt::AltModifier == QApplication::keyboardModifiers()) {
       points.append(event->pos());
@@ -206,25 +316,7 @@ void ItView::mouseMoveEvent(QMouseEvent *event) {
       }
     }
   } else if (Qt::ShiftModifier == QApplication::keyboardModifiers() || thumbing) {
-    if (function->pspace == 1) {
-      if (thumbnail != nullptr && (thumbnail->width() != thumbsize)) {
-        deleteThumbnail();
-      }
-      if (thumbnail == nullptr) {
-        thumbnail = new QImage(thumbsize, thumbsize, QImage::Format_RGB32);
-        thumbstate = new State(function->other, colormap, thumbsize, thumbsize);
-        thumbstate->getRangeFromFunction();
-        function->other->state = thumbstate;
-      }
-      function->other->setParameter(state->X(mousex), state->Y(mousey));
-      for (int y = 0; y < thumbsize; y++) {
-        for (int x = 0; x < thumbsize; x++) {
-          double pix = function->other->iterate_(thumbstate->X(x), thumbstate->Y(y));
-          thumbnail->setPixel(x, y, colormap->getColor(pix));
-        }
-      }
-      update();
-    }
+    renderThumbnail();
   } else {
     thumbing = false;
     deleteThumbnail();
@@ -256,6 +348,20 @@ void ItView::addOrbit() {
 }
 
 void ItView::wheelEvent(QWheelEvent *event) {
+  if (panning) { // one level (2x) per step, around the mouse
+    int mx = (int)event->position().x(), my = (int)event->position().y();
+    if (event->angleDelta().y() > 0 && panLevel < 40) { // keeps world pixels below 2^53
+      panLevel++;
+      panx = (panx + mx) * 2 - mx;
+      pany = (pany + my) * 2 - my;
+    } else if (event->angleDelta().y() < 0 && panLevel > -30) {
+      panLevel--;
+      panx = floorDiv(panx + mx, 2) - mx;
+      pany = floorDiv(pany + my, 2) - my;
+    }
+    renderPan();
+    return;
+  }
   const double scaleFactor = 1.15;
   double factor = (event->angleDelta().y() > 0) ? scaleFactor : 1.0 / scaleFactor;
 
@@ -299,12 +405,16 @@ void ItView::keyPressEvent(QKeyEvent *event) {
     setThumbing(!thumbing);
   } else if (event->key() == 80) { // 80='p'
     acceptThumb();
+  } else if (event->key() == 77) { // 77='m'
+    if (panning) endPan();
+    else beginPan();
   } else if (event->key() == 68) { // 68='d'
     if (function->pspace == 0) {
       extern MainWindow *mainWindow;
       mainWindow->on_pspace_radio_clicked();
     }
   } else if (event->key() == Qt::Key_Escape) { // escape
+    if (panning) endPan();
     zoom = 1.0;
     pan = QPoint(0, 0);
     selecting = 0;
@@ -332,26 +442,6 @@ void ItView::keyReleaseEvent(QKeyEvent *event) {
 
 ////////////////////////// Rendering Algo /////////////////////////////////////
 
-class Tile : public QRunnable {
-public:
-  int x, y; // top left corner
-  int w, h; // dimensions
-  int hw, hh, w2, h2;
-  Function *fun;  // copy of function - use for thread safety
-  ItView *itview;
-  int phase;
-public:
-  Tile(ItView *v, int x_, int y_, int w_, int h_, Function *f) {
-    itview = v; fun = f; x = x_; y = y_; w = w_; h = h_;
-    hw = w / 2; hh = h / 2; w2 = w - hw; h2 = h - hh;
-    phase = 0;
-    setAutoDelete(false);
-  }
-  ~Tile() { if (fun && fun->iscopy) delete fun; }
-  void run() override { itview->renderTile(this); }
-  inline int size() { return w * h; }
-};
-
 void ItView::startRender(Function *function_, State *state_, Colormap *colormap_) {
   function = function_;
   state = state_;
@@ -360,9 +450,15 @@ void ItView::startRender(Function *function_, State *state_, Colormap *colormap_
   int h = state->getHeight();
   int w = state->getWidth();
 
-  if (rendering.load())
+  State *panned = panState; // holds the new view after endPan
+  if (panning) {
+    renderer->stop();
+    harvestPan();
+    panning = false;
+  }
+  panState = nullptr;
+  if (renderer->isRendering())
     stopRender();
-  rendering = true;
 
   if (image != nullptr) {
     if (image->width() != w || image->height() != h) {
@@ -377,144 +473,84 @@ void ItView::startRender(Function *function_, State *state_, Colormap *colormap_
   resize(QSize(w, h));
   adjustSize();
 
-  totalPixels = w * h;
-  pendingPixels = totalPixels;
   elapsedTimer.start();
 
+  deleteThumbnail(); // see onRenderFinished
   qDebug() << "starting";
   function->state = state;
   function->setColors();
   function->start(debug);
-
-  if (singlethreaded) {
-    Tile *tile = new Tile(this, 0, 0, w, h, function->copy_());
-    tile->phase = 4; // calc all directly
-    //renderTile(tile);
-    threadPool->start(tile);
-  } else {
-#if 0 // STRIPES
-    int th = h / cores;
-    for (int y = 0; y < h; y += th) {
-      int tile_h = std::min(th, h - y);
-      Tile *tile = new Tile(this, 0, y, w, tile_h, function->copy_());
-      tile->phase = 4;
-      tiles.append(tile);
-      threadPool->start(tile);
-    }
-#else
-    const int ini_tile_size = 50;
-    for (int y = 0; y < h; y += ini_tile_size) {
-      for (int x = 0; x < w; x += ini_tile_size) {
-        int tile_w = std::min(ini_tile_size, w - x);
-        int tile_h = std::min(ini_tile_size, h - y);
-        //qDebug() << "tile" << x << y << tile_w << tile_h;
-        Tile *tile = new Tile(this, x, y, tile_w, tile_h, function->copy_());
-        tiles.append(tile);
-        threadPool->start(tile);
-      }
-    }
-#endif
+  state->setTiling(renderer->tilesize); // one storage block per render tile
+  if (panned) {
+    state->seedFrom(panned, 0.001);
+    delete panned;
   }
+  renderer->start(function, state, singlethreaded);
   progressTimer->start(250);
   image->fill(Qt::GlobalColor::black);
   update();
 }
 
 void ItView::onProgressTimer() {
-  if (!rendering.load()) progressTimer->stop();
-  int pp = pendingPixels.load();
-  int percent = 100 - ((100 * pp) / totalPixels);
+  if (!renderer->isRendering()) progressTimer->stop();
+  int percent = renderer->progress();
   emit progressUpdated(percent);
-  qDebug() << percent << "% done, pp =" << pp;
-  map();
+  qDebug() << percent << "% done, pp =" << renderer->pendingPixels.load();
+  if (panning) mapPan();
+  else map();
   update();
 }
 
 void ItView::stopRender() {
-  if (!rendering.load()) return;
-  rendering = false;
+  deleteThumbnail(); // before the function it copies goes
+  if (!renderer->isRendering()) return;
   progressTimer->stop();
   qDebug() << "Stopping...";
-  threadPool->waitForDone();
+  renderer->stop();
   qDebug() << "Stopped";
-  for (Tile *tile: tiles) delete tile; tiles.clear();
-  map();
+  if (panning) {
+    harvestPan();
+    mapPan();
+  } else {
+    map();
+  }
   update();
 }
 
 void ItView::onRenderFinished() {
   double msec = elapsedTimer.elapsed();
-  rendering = false;
+  if (!renderer->finish()) return; // signal from a render that was restarted
+  if (panning) {
+    progressTimer->stop();
+    harvestPan();
+    mapPan();
+    update();
+    return;
+  }
   selecting = 0;
   progressTimer->stop();
-  //threadPool->waitForDone();
-  for (Tile *tile: tiles) delete tile; tiles.clear();
   if (annotate) function->annotate();
   if (sandbox) function->sandbox();
-  map();
+  map(true); // the whole last frame, whatever the dirty flags say
   update();
   extern MainWindow *mainWindow;
   qDebug() << "finished in " << msec << " msec";
   mainWindow->statusBar()->showMessage(QString("Finished in %1 ms (%2 cores)").arg(msec).arg(singlethreaded ? 1 : cores));
-}
-
-// 0---1---+
-// |   |   |
-// 2-- 3---+
-// |   |   |
-// +---+---+
-void ItView::renderTile(Tile *tile) {
-  int pp;
-  if (!rendering.load()) return;
-  if (tile->phase == 0) {
-    double pix = tile->fun->iterate_(state->X(tile->x), state->Y(tile->y));
-    state->setPixelRegion(tile->x, tile->y, pix, tile->w, tile->h);
-  } else if (tile->phase == 1) {
-    int x = tile->x + tile->hw;
-    int y = tile->y;
-    int w = tile->w2;
-    int h = tile->hh;
-    state->setPixelRegion(x, y, tile->fun->iterate_(state->X(x), state->Y(y)), w, h);
-  } else if (tile->phase == 2) {
-    int x = tile->x;
-    int y = tile->y + tile->hh;
-    int w = tile->hw;
-    int h = tile->h2;
-    state->setPixelRegion(x, y, tile->fun->iterate_(state->X(x), state->Y(y)), w, h);
-  } else if (tile->phase == 3) {
-    int x = tile->x + tile->hw;
-    int y = tile->y + tile->hh;
-    int w = tile->w2;
-    int h = tile->h2;
-    state->setPixelRegion(x, y, tile->fun->iterate_(state->X(x), state->Y(y)), w, h);
-  } else { // final phase 4
-    for (int y = tile->y; y < tile->y + tile->h; y++) {
-      if (!rendering.load()) return;
-      int idx = state->getPixelIndex(tile->x, y);
-      for (int x = tile->x; x < tile->x + tile->w; x++) {
-        if (!state->isSetAt(idx))
-          state->setPixelAt(idx, tile->fun->iterate_(state->X(x), state->Y(y)));
-        //QObject().thread()->usleep(100); // slow down
-        idx++;
-      }
-      pp = pendingPixels.fetch_sub(tile->w) - tile->w;
-    }
-    //int pp = pendingPixels.load(); //fetch_sub(tile->size()) - tile->size();
-    //qDebug() << "renderTile" << tile->x << tile->y << tile->w << tile->h << "FULL" << pp;
-    if (pp == 0) {
-      emit renderFinished();
-    }
-    return;
-  }
-  tile->phase++;
-  threadPool->start(tile);
+  if (thumbing) renderThumbnail();
 }
 
 void ItView::restore(Function *function_, State *state_, Colormap *colormap_) {
   function = function_;
   state = state_;
   colormap = colormap_;
-  if (rendering.load())
+  if (panState) {
+    renderer->stop();
+    function->state = state;
+    delete panState;
+    panState = nullptr;
+    panning = false;
+  }
+  if (renderer->isRendering())
     stopRender();
 
   int h = state->getHeight();
@@ -532,32 +568,166 @@ void ItView::restore(Function *function_, State *state_, Colormap *colormap_) {
   resize(QSize(w, h));
   adjustSize();
 
-  map();
+  map(true);
   update();
 }
 
-void ItView::map() {
+void ItView::map(bool all) {
   int h = state->getHeight();
   int w = state->getWidth();
+  int tw = state->getTileWidth();
+  int th = state->getTileHeight();
   const uchar *bits = image->bits();
   ibits = (uint *)bits;
-  int idx = 0;
-  for (int y = 0; y < h; y++) {
-    for (int x = 0; x < w; x++) {
-      double pix = state->getPixelAt(idx);
-      ibits[idx++] = colormap->getColor(pix); //image->setPixel(x, y, colormap->getColor(pix));
+  for (int ty = 0; ty < h; ty += th) {
+    for (int tx = 0; tx < w; tx += tw) {
+      if (!state->takeDirty(tx, ty) && !all) continue;
+      int n = std::min(tw, w - tx);
+      for (int y = ty; y < std::min(ty + th, h); y++) {
+        state->mapPixels(state->getPixelIndex(tx, y), n, colormap, ibits + y * w + tx);
+      }
     }
   }
 }
 
 void ItView::setColormap(Colormap *colormap_) {
   colormap = colormap_;
-  if (rendering.load()) stopRender();
+  if (renderer->isRendering()) stopRender();
   if (image == nullptr) return;
-  map();
+  if (panning) mapPan();
+  else map(true);
+  mapThumbnail();
   update();
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Pan mode
+///////////////////////////////////////////////////////////////////////////////
+
+// Pixels are only valid for the same function, space and arguments
+static std::string sceneOf(Function *f) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%p %d", (void *)f, f->pspace);
+  std::string scene = f->name + " " + buf;
+  for (int i = 0; i < f->args.count(); i++) {
+    ItArg *arg = f->args.getArgAt(i);
+    scene += " " + arg->name() + "=" + arg->toString();
+  }
+  return scene;
+}
+
+// The current frame becomes level 0 of the world, from pixel (0, 0) on
+void ItView::beginPan() {
+  if (state == nullptr || function == nullptr || image == nullptr) return;
+  if (renderer->isRendering()) stopRender();
+  int w = state->getWidth(), h = state->getHeight();
+  if (w < 2 || h < 2) return;
+  TileGrid grid;
+  grid.ax = state->qX(0);
+  grid.ay = state->qY(0);
+  grid.sx = state->spanx / (w - 1);
+  grid.sy = state->spany / (h - 1);
+  grid.tilesize = renderer->tilesize;
+  grid.scene = sceneOf(function);
+  if (grid != tileGrid) {
+    tileCache.clear();
+    tileGrid = grid;
+  }
+  int T = grid.tilesize;
+  for (int ty = 0; ty + T <= h; ty += T) {
+    for (int tx = 0; tx + T <= w; tx += T) {
+      TileKey key = { 0, tx / T, ty / T };
+      if (tileCache.contains(key) || !state->isRegionSet(tx, ty, T, T)) continue;
+      std::vector<double> pixels(T * T);
+      state->getRegion(tx, ty, T, T, pixels.data());
+      tileCache.insert(key, std::move(pixels));
+    }
+  }
+  panning = true;
+  panLevel = 0;
+  panx = pany = 0;
+  zoom = 1.0;
+  pan = QPoint(0, 0);
+  selecting = 0;
+  selection.setSize(QSize(0, 0));
+  points.clear();
+  renderPan();
+}
+
+// Render the panned view as a regular frame, seeded from panState
+void ItView::endPan() {
+  if (!panning) return;
+  extern MainWindow *mainWindow;
+  mainWindow->on_actionStart_triggered(); // see startRender
+}
+
+// Render the tiles around the view, starting from the cached ones
+void ItView::renderPan() {
+  if (renderer->isRendering()) renderer->stop();
+  harvestPan();
+  delete panState;
+  int T = tileGrid.tilesize;
+  int w = image->width(), h = image->height();
+  panStatex = floorDiv(panx, T) * T;
+  panStatey = floorDiv(pany, T) * T;
+  int sw = (int)(floorDiv(panx + w - 1, T) * T + T - panStatex);
+  int sh = (int)(floorDiv(pany + h - 1, T) * T + T - panStatey);
+  panState = new State(function, colormap, sw, sh, state->getPixelFormat(), T);
+  tileGrid.setRange(panState, panLevel, panStatex, panStatey);
+  panState->storeArgs(function);
+  panState->pspace = function->pspace;
+  panState->clear();
+  for (int ty = 0; ty < sh; ty += T) {
+    for (int tx = 0; tx < sw; tx += T) {
+      const std::vector<double> *pixels = tileCache.find({ panLevel, (panStatex + tx) / T, (panStatey + ty) / T });
+      if (pixels) panState->setRegion(tx, ty, T, T, pixels->data());
+    }
+  }
+  function->state = panState;
+  function->setColors();
+  function->start(debug);
+  renderer->start(function, panState, singlethreaded);
+  progressTimer->start(250);
+  mapPan();
+  update();
+
+  qdouble cx, cy;
+  double vw, vh;
+  tileGrid.window(panLevel, panx, pany, w, h, cx, cy, vw, vh);
+  extern MainWindow *mainWindow;
+  mainWindow->showCoordinates(cx, cy, vw, vh);
+  mainWindow->statusBar()->showMessage(QString("Panning, level %1: %2 tiles cached (%3 MB)")
+    .arg(panLevel).arg(tileCache.memoryUsed() / (T * T * sizeof(double))).arg(tileCache.memoryUsed() >> 20));
+}
+
+// Move finished tiles of panState to the cache; only while not rendering
+void ItView::harvestPan() {
+  if (panState == nullptr) return;
+  int T = tileGrid.tilesize;
+  for (int ty = 0; ty < panState->getHeight(); ty += T) {
+    for (int tx = 0; tx < panState->getWidth(); tx += T) {
+      TileKey key = { panLevel, (panStatex + tx) / T, (panStatey + ty) / T };
+      if (tileCache.contains(key) || !panState->isRegionSet(tx, ty, T, T)) continue;
+      std::vector<double> pixels(T * T);
+      panState->getRegion(tx, ty, T, T, pixels.data());
+      tileCache.insert(key, std::move(pixels));
+    }
+  }
+}
+
+void ItView::mapPan() {
+  int w = image->width(), h = image->height();
+  int dx = (int)(panx - panStatex), dy = (int)(pany - panStatey);
+  ibits = (uint *)image->bits();
+  for (int y = 0; y < h; y++) {
+    for (int x = 0; x < w; ) {
+      int n = std::min(panState->getRunLength(x + dx), w - x);
+      panState->mapPixels(panState->getPixelIndex(x + dx, y + dy), n, colormap, ibits + y * w + x);
+      x += n;
+    }
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Export and printing
 ///////////////////////////////////////////////////////////////////////////////
@@ -3,17 +3,15 @@
 
 #include <QWidget>
 #include <QImage>
-#include <QThreadPool>
-#include <QRunnable>
 #include <QTimer>
 #include <QElapsedTimer>
 
 #include "Function.h"
 #include "Colormap.h"
 #include "State.h"
-#include <atomic>
+#include "Render.h"
+#include "TileCache.h"
 
-class Tile;
 class QPrinter;
 
 class ItView : public QWidget {
@@ -24,9 +22,11 @@ public:
 signals:
   void progressUpdated(int percentage);
   void renderFinished();
+  void thumbnailFinished();
 public slots:
   void onProgressTimer();
   void onRenderFinished();
+  void onThumbnailFinished();
 
 protected:
   void drawAnnotations(QPainter &painter, const std::vector<Annotation*> &annotations);
@@ -46,11 +46,15 @@ public:
 public:
   void clear();
   void startRender(Function *function, State *state, Colormap *colormap);
+  int tileSize() { return renderer->tilesize; }
+  void setTileCacheBudget(size_t bytes) { tileCache.setBudget(bytes); }
+  // Supersample edges after each render, see Renderer::aaSamples
+  void setAntialias(int samples, double threshold) { renderer->aaSamples = samples; renderer->aaThreshold = threshold; }
+
   void stopRender();
+  bool isRendering() { return renderer->isRendering(); }
   void restore(Function *function, State *state, Colormap *colormap);
   void setColormap(Colormap *colormap);
-  Tile *getTile();
-  void renderTile(Tile *tile);
   void setThumbing(bool flag);
   void acceptThumb();
   void deleteThumbnail();
@@ -67,13 +71,16 @@ public:
   void printPreview();
   void printContent(QPrinter *printer);
 private:
-  std::atomic<bool> rendering;
-  std::atomic<int> pendingPixels;
-  int totalPixels;
+  Renderer *renderer;
   QImage *image;
   uint *ibits;
   QImage *thumbnail;
-  QThreadPool *threadPool;
+  // The thumbnail renders on workers of its own, see renderThumbnail
+  Renderer *thumbRenderer;
+  Function *thumbFunction;  // own instance of function->other (MainWindow::newInstance)
+  QTimer *thumbTimer;       // shows the coarse passes
+  void renderThumbnail();
+  void mapThumbnail();
   QElapsedTimer elapsedTimer;
   QTimer *progressTimer;
   Function *function;
@@ -87,12 +94,26 @@ private:
   double zoom;
   QPointF pan;
   QList<QPoint> points;
-  QList<Tile*> tiles;
-  void map();
+  void map(bool all = false); // pixels to image; only changed tiles unless all
   QColor selectionColor;
   QColor orbitColor;
   QColor drawColor;
   void randomizeColors();
+  // Pan mode ('m'): the view is a window onto tileGrid at panLevel; only
+  // tiles missing from tileCache are rendered, into the tile-aligned panState
+  bool panning;
+  TileGrid tileGrid;
+  TileCache tileCache;
+  State *panState;
+  int panLevel;
+  long long panx, pany;             // world pixel at the top left of the view
+  long long panStatex, panStatey;   // world pixel at panState's (0, 0)
+  QPoint panMouse;
+  void beginPan();
+  void endPan();
+  void renderPan();
+  void harvestPan();
+  void mapPan();
 };
 
 #endif // ITVIEW_H
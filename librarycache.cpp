@@ -0,0 +1,90 @@
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDebug>
+
+#include "librarycache.h"
+
+LibraryCache::LibraryCache() {
+  budget = (qint64)256 << 20;
+}
+
+void LibraryCache::setDirectory(const QString &dir) {
+  directory = dir;
+  if (!directory.isEmpty() && !directory.endsWith("/")) directory += "/";
+  if (!directory.isEmpty()) QDir().mkpath(directory);
+}
+
+void LibraryCache::setBudget(qint64 bytes) {
+  budget = bytes;
+}
+
+static void addFile(QCryptographicHash &hash, const QString &path) {
+  QFile file(path);
+  if (file.open(QIODevice::ReadOnly)) hash.addData(&file);
+  hash.addData(QByteArray(1, '\0')); // separator
+}
+
+/*static*/ QByteArray LibraryCache::keyOf(const QString &source, const QString &prefix, const QString &runtime,
+                                          const QString &script, const QString &flags) {
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  addFile(hash, source);
+  addFile(hash, prefix);
+  QDir dir(runtime);
+  for (const QString &name: dir.entryList({"*.h", "*.cpp"}, QDir::Files, QDir::Name)) {
+    hash.addData(name.toUtf8());
+    addFile(hash, dir.filePath(name));
+  }
+  addFile(hash, script);
+  hash.addData(flags.toUtf8());
+  return hash.result().toHex();
+}
+
+QString LibraryCache::fileOf(const QByteArray &key, const QString &suffix) {
+  return directory + QString::fromLatin1(key) + "." + suffix;
+}
+
+QString LibraryCache::find(const QByteArray &key, const QString &suffix) {
+  if (directory.isEmpty()) return QString();
+  QString name = fileOf(key, suffix);
+  QFile file(name);
+  if (!file.exists()) return QString();
+  if (file.open(QIODevice::ReadWrite)) // recently used
+    file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+  return name;
+}
+
+// Copied under another name and renamed, so that a library is complete when found
+QString LibraryCache::store(const QByteArray &key, const QString &lib) {
+  if (directory.isEmpty()) return QString();
+  QString name = fileOf(key, QFileInfo(lib).suffix());
+  QString part = name + ".part";
+  QFile::remove(part);
+  if (!QFile::copy(lib, part)) {
+    qDebug() << "Could not copy" << lib << "to the library cache";
+    return QString();
+  }
+  QFile::remove(name);
+  if (!QFile::rename(part, name)) {
+    QFile::remove(part);
+    return QString();
+  }
+  evict(name);
+  return name;
+}
+
+// Oldest modification time first: find touches the libraries it returns
+void LibraryCache::evict(const QString &keep) {
+  if (directory.isEmpty()) return;
+  QDir dir(directory);
+  QFileInfoList files = dir.entryInfoList(QDir::Files, QDir::Time | QDir::Reversed);
+  qint64 used = 0;
+  for (const QFileInfo &info: files) used += info.size();
+  for (const QFileInfo &info: files) {
+    if (used <= budget) break;
+    if (info.absoluteFilePath() == QFileInfo(keep).absoluteFilePath()) continue;
+    if (QFile::remove(info.absoluteFilePath())) used -= info.size(); // fails for a library loaded on Windows
+  }
+}
@@ -0,0 +1,31 @@
+#ifndef LIBRARYCACHE_H
+#define LIBRARYCACHE_H
+
+#include <QString>
+#include <QByteArray>
+
+// Compiled function libraries, named by a hash of everything that goes into
+// them, so that loading a function compiled before (also in an earlier
+// session) needs no compiler run. As a library's name changes with its
+// content, a new build is never loaded under the name of an old one.
+// The least recently used are deleted beyond the budget.
+class LibraryCache {
+public:
+  LibraryCache();
+  void setDirectory(const QString &dir);
+  void setBudget(qint64 bytes);
+  // Files: the function source and prefix, the runtime sources (directory
+  // it/) and the compile script, which holds the flags; flags: the profile
+  // and instruction set
+  static QByteArray keyOf(const QString &source, const QString &prefix, const QString &runtime,
+                          const QString &script, const QString &flags);
+  QString find(const QByteArray &key, const QString &suffix); // path if cached, else empty
+  QString store(const QByteArray &key, const QString &lib);   // path of the cached copy, empty on failure
+  void evict(const QString &keep);                            // keep: a library in use
+private:
+  QString directory;
+  qint64 budget;
+  QString fileOf(const QByteArray &key, const QString &suffix);
+};
+
+#endif // LIBRARYCACHE_H
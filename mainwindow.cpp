@@ -13,9 +13,16 @@
 #include <QRegularExpression>
 #include <QTextBrowser>
 #include <QDesktopServices>
+#include <QCryptographicHash>
+#ifdef Q_OS_UNIX
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
 #include "mainwindow.h"
 #include "./ui_mainwindow.h"
 #include "Function.h"
+#include "Formula.h"
 #include "paramsmodel.h"
 #include "syntaxhighlightercpp.h"
 #include "jupyter.h"
@@ -63,11 +70,18 @@ MainWindow::MainWindow(bool darkMode, QWidget *parent) : QMainWindow(parent), ui
   function = nullptr;
   colormap = nullptr;
   state = nullptr;
+  pixelFormat = PIX_DOUBLE;
+  seedTolerance = 0.001;
+  aaSamples = 8;
+  aaThreshold = 0.02;
   jupyter = nullptr;
 
   dylib = nullptr;
   createfun = nullptr;
   deletefun = nullptr;
+  compiler = nullptr;
+  speculating = false;
+  startWhenLoaded = false;
 
   // New-style colormaps
   std::vector<std::string> newmaps;
@@ -95,8 +109,13 @@ MainWindow::MainWindow(bool darkMode, QWidget *parent) : QMainWindow(parent), ui
   codeHasChanged = false;
   codeHasErrors = false;
   highlighter = new SyntaxHighlighterCPP(ui->codeEditor->document());
+  speculateTimer = new QTimer(this);
+  speculateTimer->setSingleShot(true);
+  speculateTimer->setInterval(800); // after typing pauses
+  connect(speculateTimer, &QTimer::timeout, this, &MainWindow::speculate);
   connect(ui->codeEditor, &QPlainTextEdit::textChanged, this, [=]() {
     codeHasChanged = true;
+    speculateTimer->start();
   });
   connect(ui->errorsView, &QPlainTextEdit::cursorPositionChanged, this, [=]() {
     QTextCursor cursor = ui->errorsView->textCursor();
@@ -105,11 +124,11 @@ MainWindow::MainWindow(bool darkMode, QWidget *parent) : QMainWindow(parent), ui
     qDebug() << "User clicked on line:" << displayLineNumber;
     QString line = cursor.block().text();
     qDebug() << "Line text:" << line;
-    if (line.startsWith("ITFUN.cpp:")) {
+    if (line.startsWith("ITFUN.cpp:") || line.startsWith("formula:")) {
       QRegularExpression regex(R"(:(\d+):(\d+):)");
       QRegularExpressionMatch match = regex.match(line);
       if (match.hasMatch()) {
-        int lineno = match.captured(1).toInt() - 1 - 9; // length of prefix
+        int lineno = match.captured(1).toInt() - 1; // the prefix is included, not prepended
         int column = match.captured(2).toInt() - 1;
         cursor = ui->codeEditor->textCursor();
         ui->codeEditor->setFocus();
@@ -155,6 +174,7 @@ MainWindow::MainWindow(bool darkMode, QWidget *parent) : QMainWindow(parent), ui
 }
 
 MainWindow::~MainWindow() {
+  cancelCompile();
   ui->itView->stopRender();
   if (jupyter != nullptr) jupyter->stopServer();
   delete ui;
@@ -234,6 +254,23 @@ void MainWindow::loadSettings() {
   }
   if (settings.contains("exportDirectory")) exportDirectory = settings.value("exportDirectory").toString();
   if (settings.contains("filesDirectory")) filesDirectory = settings.value("filesDirectory").toString();
+  // "double" (default), "float", "uint16" or "rgb32"
+  if (settings.contains("pixelFormat")) pixelFormat = State::getPixelFormatByName(settings.value("pixelFormat").toString().toStdString());
+  // in pixels; 0.001 reuses only aligned sample points, negative disables
+  if (settings.contains("seedTolerance")) seedTolerance = settings.value("seedTolerance").toDouble();
+  if (settings.contains("tileCacheMB")) ui->itView->setTileCacheBudget((size_t)settings.value("tileCacheMB").toInt() << 20);
+  if (settings.contains("antialiasSamples")) aaSamples = settings.value("antialiasSamples").toInt();
+  if (settings.contains("antialiasThreshold")) aaThreshold = settings.value("antialiasThreshold").toDouble();
+  // in MB, compressed; older frames of the history go to a temporary directory
+  if (settings.contains("historyMB")) history.setBudget((qint64)settings.value("historyMB").toInt() << 20);
+  // in MB, 0 disables the render cache
+  renderCache.setDirectory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/renders");
+  if (settings.contains("renderCacheMB")) renderCache.setBudget((qint64)settings.value("renderCacheMB").toInt() << 20);
+  // passed to the compile scripts as IT_MARCH; empty: this machine's
+  if (settings.contains("functionArch")) functionArch = settings.value("functionArch").toString();
+  // in MB
+  libraryCache.setDirectory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/functions");
+  if (settings.contains("libraryCacheMB")) libraryCache.setBudget((qint64)settings.value("libraryCacheMB").toInt() << 20);
 }
 
 void MainWindow::saveSettings() {
@@ -558,6 +595,20 @@ void MainWindow::on_actionNew_Function_triggered() {
   }
 }
 
+// A function file holding a formula, see Formula.h
+void MainWindow::on_actionNew_Formula_triggered() {
+  bool ok = false;
+  QString fname = QInputDialog::getText(this,
+    "New Formula",
+    "Formula name:", QLineEdit::Normal,
+    "", &ok);
+  if (ok && !fname.isEmpty()) {
+    if (!saveCode(fname, Formula::example())) return;
+    ui->treeView->addItem(fname);
+    saveFunctionList();
+  }
+}
+
 void MainWindow::on_actionSave_triggered() {
   if (currFunction.isEmpty()) return;
   if (!saveCode(currFunction, ui->codeEditor->toPlainText())) {
@@ -699,6 +750,10 @@ void MainWindow::on_actionCompile_triggered() {
 }
 
 void MainWindow::on_actionStart_triggered() {
+  if (compiler != nullptr && !speculating) {
+    startWhenLoaded = true; // see compileAndLoad
+    return;
+  }
   if (codeHasChanged) {
     setFunction(currFunction, true); // reload and recompile if necessary
     return;
@@ -707,49 +762,66 @@ void MainWindow::on_actionStart_triggered() {
 }
 
 void MainWindow::start() {
-  double xmin, xmax, ymin, ymax;
+  qdouble cx, cy;
+  double w, h;
 
   if (function == nullptr) return;
   if (colormap == nullptr) return;
   ui->stackedWidget->setCurrentIndex(IMAGE_TAB);
 
   if (state != nullptr && !ui->itView->selection.isEmpty()) { // auto-zoom
+    // relative to the current center, so no precision is lost at any depth
     QRect &sel = ui->itView->selection;
-    xmin = state->X(sel.x());
-    xmax = state->X(sel.x() + sel.width());
-    ymin = state->Y(sel.y() + sel.height());
-    ymax = state->Y(sel.y());
-    ui->xmin_le->setText(QString::number(xmin));
-    ui->xmax_le->setText(QString::number(xmax));
-    ui->ymin_le->setText(QString::number(ymin));
-    ui->ymax_le->setText(QString::number(ymax));
+    cx = state->qX(sel.x() + 0.5 * sel.width());
+    cy = state->qY(sel.y() + 0.5 * sel.height());
+    w = state->dX(sel.x() + sel.width()) - state->dX(sel.x());
+    h = state->dY(sel.y()) - state->dY(sel.y() + sel.height());
+    showCoordinates(cx, cy, w, h);
   } else {
-    xmin = ui->xmin_le->text().toDouble();
-    xmax = ui->xmax_le->text().toDouble();
-    ymin = ui->ymin_le->text().toDouble();
-    ymax = ui->ymax_le->text().toDouble();
+    qdouble xmin, xmax, ymin, ymax;
+    getCoordinates(xmin, xmax, ymin, ymax);
+    cx = (xmin + xmax) * 0.5;
+    cy = (ymin + ymax) * 0.5;
+    w = (xmax - xmin).toDouble();
+    h = (ymax - ymin).toDouble();
   }
   ui->itView->selection.setSize(QSize(0, 0));
 
   int xres = ui->resolution_xres->text().toInt();
-  int yres = (int)(xres * (ymax - ymin) / (xmax - xmin));
+  int yres = (int)(xres * h / w);
 
   if (state != nullptr) {
-    history.push_back(state);
+    history.push(state);
   }
-  state = new State(function, colormap, xres, yres);
-  state->setRange(xmin, xmax, ymin, ymax);
+  state = new State(function, colormap, xres, yres, pixelFormat, ui->itView->tileSize());
+
+  state->setRange(cx, cy, w, h);
   state->setColormap(colormap);
   state->storeArgs(function);
   state->pspace = function->pspace;
   state->clear();
   function->state = state;
+  // debug output and sandbox drawing only come from an actual render
+  renderKey.clear();
+  bool cached = false;
+  if (renderCache.isEnabled() && !ui->debug_cb->isChecked() && !ui->sandbox_cb->isChecked()) {
+    QString key = RenderCache::keyOf(functionHash, function, state, ui->antialias_cb->isChecked() ? aaSamples : 0, aaThreshold);
+    cached = renderCache.load(key, state);
+    if (!cached) renderKey = key;
+  }
+  if (cached) {
+    qDebug() << "Loaded the frame from the render cache";
+  } else if (seedTolerance >= 0 && !history.empty()) {
+    int seeded = state->seedFrom(history.back(), seedTolerance);
+    qDebug() << "Seeded" << seeded << "pixels from the previous frame";
+  }
 
   ui->itView->thumbsize = ui->thumb_slider->value();
   ui->itView->singlethreaded = !ui->multithread_cb->isChecked();
   ui->itView->debug = ui->debug_cb->isChecked();
   ui->itView->annotate = ui->annotate_cb->isChecked();
   ui->itView->sandbox = ui->sandbox_cb->isChecked();
+  ui->itView->setAntialias(ui->antialias_cb->isChecked() ? aaSamples : 0, aaThreshold);
 
   ui->itView->startRender(function, state, colormap);
   ui->actionStop->setEnabled(true);
@@ -763,6 +835,13 @@ void MainWindow::on_thumb_slider_actionTriggered(int action) {
 }
 
 void MainWindow::on_actionStop_triggered() {
+  if (compiler != nullptr && !speculating) {
+    cancelCompile();
+    codeHasChanged = true; // compile again on Start
+    ui->actionStop->setEnabled(ui->itView->isRendering());
+    statusBar()->showMessage("Compilation canceled.");
+    return;
+  }
   ui->itView->stopRender();
   ui->actionStop->setEnabled(false);
   ui->actionBack->setEnabled(history.size() > 0);
@@ -776,6 +855,11 @@ void MainWindow::on_renderProgress(int p) {
 }
 
 void MainWindow::on_renderFinish() {
+  // after ItView::onRenderFinished, which publishes the antialiasing samples
+  if (!renderKey.isEmpty() && state && state->isRegionSet(0, 0, state->getWidth(), state->getHeight())) {
+    renderCache.store(renderKey, state);
+    renderKey.clear();
+  }
   ui->preview->setProgress(100);
   ui->actionStart->setEnabled(true);
   ui->actionStop->setEnabled(false);
@@ -799,13 +883,9 @@ void MainWindow::on_actionBack_triggered() {
     ui->stackedWidget->setCurrentIndex(IMAGE_TAB);
     if (history.size() > 0) {
       if (state != nullptr) delete state;
-      state = history.back();
-      history.pop_back();
+      state = history.pop();
       ui->itView->restore(function, state, colormap);
-      ui->xmin_le->setText(QString::number(state->xmin));
-      ui->xmax_le->setText(QString::number(state->xmax));
-      ui->ymin_le->setText(QString::number(state->ymin));
-      ui->ymax_le->setText(QString::number(state->ymax));
+      showCoordinates(state->centerx, state->centery, state->spanx, state->spany);
       ui->resolution_xres->setText(QString::number(state->xres));
       ui->resolution_yres->setText(QString::number(state->yres));
       ui->pspace_radio->setChecked(state->pspace == 1); // set other?
@@ -821,12 +901,8 @@ void MainWindow::on_actionBack_triggered() {
 }
 
 void MainWindow::on_slider_res_valueChanged(int value) {
-  double xmin = ui->xmin_le->text().toDouble();
-  double xmax = ui->xmax_le->text().toDouble();
-  double ymin = ui->ymin_le->text().toDouble();
-  double ymax = ui->ymax_le->text().toDouble();
   int xres = 50 * (value / 50);
-  int yres = (int)(xres * (ymax - ymin) / (xmax - xmin));
+  int yres = yresFor(xres);
   ui->slider_res->setValue(xres);
   ui->resolution_xres->setText(QString::number(xres));
   ui->resolution_yres->setText(QString::number(yres));
@@ -869,11 +945,7 @@ void MainWindow::on_resolution_xres_editingFinished()
   int xres;
   try {
     xres = ui->resolution_xres->text().toInt();
-    double xmin = ui->xmin_le->text().toDouble();
-    double xmax = ui->xmax_le->text().toDouble();
-    double ymin = ui->ymin_le->text().toDouble();
-    double ymax = ui->ymax_le->text().toDouble();
-    int yres = (int)(xres * (ymax - ymin) / (xmax - xmin));
+    int yres = yresFor(xres);
     ui->slider_res->setValue(xres);
     ui->resolution_yres->setText(QString::number(yres));
   } catch (...) {
@@ -889,6 +961,37 @@ void MainWindow::showDefaultCoordinates() {
   ui->ymax_le->setText(QString::number(function->defymax));
 }
 
+// Full precision: the line edits are the only copy of the range between renders
+void MainWindow::getCoordinates(qdouble &xmin, qdouble &xmax, qdouble &ymin, qdouble &ymax) {
+  xmin = qdouble::fromString(ui->xmin_le->text().trimmed().toStdString());
+  xmax = qdouble::fromString(ui->xmax_le->text().trimmed().toStdString());
+  ymin = qdouble::fromString(ui->ymin_le->text().trimmed().toStdString());
+  ymax = qdouble::fromString(ui->ymax_le->text().trimmed().toStdString());
+}
+
+// Six digits more than the span needs, enough to tell pixels apart
+static QString coordString(const qdouble &v, double span) {
+  double mag = std::max(std::fabs(v.toDouble()), span);
+  int digits = span > 0 ? (int)std::ceil(std::log10(mag / span)) + 6 : 17;
+  digits = std::min(std::max(digits, 6), 64);
+
+  return QString::fromStdString(v.toString(digits));
+}
+
+void MainWindow::showCoordinates(const qdouble &cx, const qdouble &cy, double w, double h) {
+  ui->xmin_le->setText(coordString(cx - w * 0.5, w));
+  ui->xmax_le->setText(coordString(cx + w * 0.5, w));
+  ui->ymin_le->setText(coordString(cy - h * 0.5, h));
+  ui->ymax_le->setText(coordString(cy + h * 0.5, h));
+}
+
+int MainWindow::yresFor(int xres) {
+  qdouble xmin, xmax, ymin, ymax;
+  getCoordinates(xmin, xmax, ymin, ymax);
+  return (int)(xres * (ymax - ymin).toDouble() / (xmax - xmin).toDouble());
+}
+
+
 void MainWindow::on_actionExport_as_PNG_triggered() { ui->itView->exportToPNG(); }
 void MainWindow::on_actionExport_as_SVG_triggered() { ui->itView->exportToSVG(); }
 void MainWindow::on_actionExport_as_PDF_triggered() { ui->itView->exportToPDF(); }
@@ -954,7 +1057,7 @@ TreeModel *MainWindow::initFunctionList() {
   //treemodel->addFolder("Sample Functions");
   folder = new TreeItem("Samples", TreeItem::Folder);
   root->appendChild(folder);
-  QStringList builtins = { "Sample Quadratic", "Sample Newton", "Sample Milnor", "Sample Tangent", "Sample CentExponential"};
+  QStringList builtins = { "Sample Quadratic", "Sample Deep Quadratic", "Sample Newton", "Sample Milnor", "Sample Tangent", "Sample CentExponential"};
   for (const QString &f: builtins) {
     builtin.insert(f); // add to builtin set
     TreeItem *item = new TreeItem(f, TreeItem::Item);
@@ -1007,31 +1110,7 @@ void MainWindow::setFunction(const QString &newFunction, bool thenStart) {
 
   currFunction = newFunction;
 
-  // Unload current function
-  for (State *s: history) delete s;
-  state = nullptr;
-  history.clear();
-
-  if (function != nullptr) {
-    if (deletefun) {
-      deletefun(function->other);
-      deletefun(function);
-      createfun = nullptr;
-      deletefun = nullptr;
-    } else {
-      delete function->other;
-      delete function;
-    }
-    function = nullptr;
-  }
-  if (dylib != nullptr) {
-#ifdef Q_OS_LINUX
-    while (dylib->isLoaded()) dylib->unload();
-#else
-    dylib->unload();
-#endif
-    dylib = nullptr;
-  }
+  // The current function stays loaded until the new one replaces it, see swapFunction
 
   // Load function code
   QString file, fname = name2file(newFunction);
@@ -1084,21 +1163,21 @@ void MainWindow::setFunction(const QString &newFunction, bool thenStart) {
     }
   }
 
-  // Compile and load from callback (async)
-  statusBar()->showMessage("Compiling...");
-  QTimer::singleShot(0, this, [this,fname,builtin_,thenStart]() {
-    if (!compileAndLoad(fname, builtin_, thenStart)) {
-      QMessageBox msgBox;
-      msgBox.setText(QString("Failed to load function %1").arg(currFunction));
-      msgBox.exec();
-    }
-  });
+  // Compile in the background, or load right away
+  if (!compileAndLoad(fname, builtin_, thenStart)) {
+    QMessageBox msgBox;
+    msgBox.setText(QString("Failed to load function %1").arg(currFunction));
+    msgBox.exec();
+  }
 }
 
 bool MainWindow::saveCode(const QString &name, const QString &code) {
   //QString home = QStandardPaths::writableLocation(QStandardPaths::HomeLocation);
   //QString path = home + "/Library/Application Support/It/" + name2file(name) + ".cpp";
-  QString path = filesDirectory + name2file(name) + ".cpp";
+  return writeCode(filesDirectory + name2file(name) + ".cpp", code);
+}
+
+bool MainWindow::writeCode(const QString &path, const QString &code) {
   QFile file(path);
   if (file.open(QIODevice::WriteOnly | QIODevice::Text)) {
     QTextStream stream(&file);
@@ -1112,100 +1191,313 @@ bool MainWindow::saveCode(const QString &name, const QString &code) {
   }
 }
 
+// Paths and flags of a compile of filesDirectory + fname + ".cpp"
+MainWindow::Build MainWindow::buildOf(const QString &fname) {
+  Build b;
+  b.fname = fname;
+  b.source = filesDirectory + fname + ".cpp";
+  // optimized unless Debug is checked; each profile is built and kept apart
+  b.debug = ui->debug_cb->isChecked();
+  QString profile = b.debug ? "debug/" : "release/";
+#ifdef Q_OS_MACOS
+  b.lib = filesDirectory + "build/" + profile + fname + ".dylib";
+  b.exe = QApplication::applicationDirPath() + "/It";
+  b.script = QApplication::applicationDirPath() + "/../Resources/compile_macos.sh";
+  b.runtime = filesDirectory + "build/" + profile + "libitrt.a";
+  b.cmd = "bash";
+#endif
+#ifdef Q_OS_WIN
+  b.lib = filesDirectory + "build/" + profile + fname + ".dll";
+  b.exe = QApplication::applicationDirPath() + "/It.exe";
+  b.script = QApplication::applicationDirPath() + "/compile_windows.bat";
+  b.runtime = filesDirectory + "build/" + profile + "itrt.lib";
+  b.cmd = "cmd.exe";
+#endif
+#ifdef Q_OS_LINUX
+  b.lib = filesDirectory + "build/" + profile + fname + ".so";
+  b.exe = QApplication::applicationDirPath() + "/It";
+  b.script = QApplication::applicationDirPath() + "/compile_linux.sh";
+  b.runtime = filesDirectory + "build/" + profile + "libitrt.a";
+  b.cmd = "bash";
+#endif
+  b.flags = profile + functionArch;
+  return b;
+}
+
+// Depends on the source's content only, not its name, see speculate
+QByteArray MainWindow::keyOf(const Build &b) {
+  return LibraryCache::keyOf(b.source, filesDirectory + "build/prefix.txt", filesDirectory + "it", b.script, b.flags);
+}
+
+// Returns false if the function could not be loaded right away. A compile
+// runs in the background; the current function and image stay usable until
+// it has finished and the new function is swapped in.
 bool MainWindow::compileAndLoad(const QString &fname, bool builtin_, bool thenStart) {
   qDebug() << "compileAndLoad" << fname; // pass fname2file(fname)
+  QByteArray hash = QCryptographicHash::hash(ui->codeEditor->toPlainText().toUtf8(), QCryptographicHash::Sha1);
+  codeHasChanged = false;
   if (builtin_) {
-    function = createBuiltinFunction(currFunction.toStdString());
-    codeHasChanged = false;
-  } else {
-    // TODO: directories on other platforms
-    QString file = filesDirectory + fname + ".cpp";
-    int version = 0;
-  #ifdef Q_OS_MACOS
-    QString lib = filesDirectory + "build/" + fname + ".dylib";
-    QString exe = QApplication::applicationDirPath() + "/It";
-    QString comp = QApplication::applicationDirPath() + "/../Resources/compile_macos.sh";
-    QString cmd = "bash";
-  #endif
-  #ifdef Q_OS_WIN
-    QString lib = filesDirectory + "build/" + fname + ".dll";
-    QString exe = QApplication::applicationDirPath() + "/It.exe";
-    QString comp = QApplication::applicationDirPath() + "/compile_windows.bat";
-    QString cmd = "cmd.exe";
-  #endif
-  #ifdef Q_OS_LINUX
-    if (ver.contains(fname)) {
-      version = ver[fname] + 1;
-    } else {
-      version = 1;
+    cancelCompile(); // superseded
+    swapFunction(createBuiltinFunction(currFunction.toStdString()), nullptr, nullptr, nullptr);
+    functionLoaded(hash, thenStart);
+    return true;
+  }
+  std::string text = ui->codeEditor->toPlainText().toStdString();
+  if (Formula::isFormula(text)) { // interpreted: nothing to compile
+    cancelCompile(); // superseded
+    std::string error;
+    Function *f = createFormulaFunction(text, error);
+    if (f == nullptr) {
+      codeHasChanged = true; // the loaded function is still the previous one
+      showErrors(QString::fromStdString(error));
+      statusBar()->showMessage(QString("Could not compile %1").arg(currFunction));
+      return true;
     }
-    ver[fname] = version;
-    QString lib = filesDirectory + "build/" + fname + QString::number(version) + ".so";
-    QString exe = QApplication::applicationDirPath() + "/It";
-    QString comp = QApplication::applicationDirPath() + "/compile_linux.sh";
-    QString cmd = "bash";
-  #endif
-
-    QFileInfo fileinfo(file);
-    QFileInfo libinfo(lib);
-    QFileInfo exeinfo(exe);
-    codeHasChanged = false;
     codeHasErrors = false;
+    swapFunction(f, nullptr, nullptr, nullptr);
+    ui->errorsView->hide();
+    functionLoaded(hash, thenStart);
+    return true;
+  }
+  Build b = buildOf(fname);
+  QByteArray key = keyOf(b);
+  codeHasErrors = false;
 
-    int exitCode = 0;
-    if (!libinfo.exists() || fileinfo.lastModified() > libinfo.lastModified() || exeinfo.lastModified() > fileinfo.lastModified()) {
-      // Must compile
-      QProcess proc;
-      QStringList args;
-  #ifdef Q_OS_WIN
-      args << "/c";
-  #endif
-      args << comp << fname << filesDirectory << exe << "CLEAN" << QString::number(version);
-#ifdef DEBUG
-      args << "DEBUG";
-#else
-      args << "RELEASE";
-#endif
-      qDebug() << "Will compile:" << cmd << args;
-      proc.start(cmd, args);
-      proc.waitForFinished();
-      exitCode = proc.exitCode();
-    } else {
+  if (compiler != nullptr && speculating && compileKey == key) {
+    // the same code is being compiled from the editor: load it when done
+    speculating = false;
+  } else {
+    cancelCompile(); // superseded
+    QString cached = libraryCache.find(key, QFileInfo(b.lib).suffix());
+    if (!cached.isEmpty()) {
       qDebug() << "No need to compile";
       ui->errorsView->hide();
+      return loadLibrary(cached, hash, thenStart);
     }
-    if (exitCode == 0) {
-      qDebug() << "Compiled ok";
-      dylib = new QLibrary(lib);
-      if (dylib->load()) {
-        //  typedef void (*DestroyFunctionPtr)(void*);
-        //  DestroyFunctionPtr destroyFunction = (DestroyFunctionPtr)dylib->resolve("_destroyFunction");
-        createfun = (CreateFunction)dylib->resolve("_createFunction");
-        deletefun = (DeleteFunction)dylib->resolve("_deleteFunction");
-        if (createfun == nullptr) { qDebug() << "Could not resolve function"; return false; }
-        if (deletefun == nullptr) { qDebug() << "Could not resolve function"; return false; }
-        function = createfun(1); // param space first
-        function->other = createfun(0); // dyn space is other
-        function->other->other = function;
-        ui->errorsView->hide();
-      } else {
-        qDebug() << "Could not load: " << dylib->errorString();
-      }
+    startCompile(b, key, false);
+  }
+  compileHash = hash;
+  startWhenLoaded = thenStart;
+  statusBar()->showMessage(QString("Compiling %1...").arg(currFunction));
+  ui->actionStop->setEnabled(true); // cancels
+  return true;
+}
+
+// Compile the code being edited once typing pauses, from a scratch copy and
+// only into libraryCache: Start then finds it there (or being compiled, see
+// compileAndLoad), and errors show while editing.
+void MainWindow::speculate() {
+  if (!codeHasChanged || currFunction.isEmpty() || builtin.contains(currFunction)) return;
+  if (ui->codeEditor->document()->isEmpty()) return;
+  if (compiler != nullptr) {
+    if (!speculating) return; // compiling for Start
+    cancelCompile(); // outdated
+  }
+  std::string text = ui->codeEditor->toPlainText().toStdString();
+  if (Formula::isFormula(text)) { // checked right away
+    std::string error;
+    delete Formula::compile(text, error);
+    if (!error.empty()) {
+      showErrors(QString::fromStdString(error));
     } else {
-      codeHasErrors = true;
+      codeHasErrors = false;
+      ui->errorsView->hide();
+    }
+    return;
+  }
+  Build b = buildOf(name2file(currFunction) + "-edit");
+  if (!writeCode(b.source, ui->codeEditor->toPlainText())) return;
+  QByteArray key = keyOf(b);
+  if (!libraryCache.find(key, QFileInfo(b.lib).suffix()).isEmpty()) {
+    QFile::remove(b.source);
+    ui->errorsView->hide();
+    return;
+  }
+  startCompile(b, key, true);
+}
+
+void MainWindow::startCompile(const Build &b, const QByteArray &key, bool speculative) {
+  QStringList args;
+#ifdef Q_OS_WIN
+  args << "/c";
+#endif
+  // the runtime and the precompiled prefix are kept until It itself changes
+  QFileInfo exeinfo(b.exe);
+  QFileInfo runtimeinfo(b.runtime);
+  bool clean = !runtimeinfo.exists() || exeinfo.lastModified() > runtimeinfo.lastModified();
+  args << b.script << b.fname << filesDirectory << b.exe << (clean ? "CLEAN" : "KEEP") << "0";
+  args << (b.debug ? "DEBUG" : "RELEASE");
+  compiler = new QProcess(this);
+  compileKey = key;
+  speculating = speculative;
+  scratchSource = speculative ? b.source : QString();
+  if (!functionArch.isEmpty()) {
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+    env.insert("IT_MARCH", functionArch);
+    compiler->setProcessEnvironment(env);
+  }
+#ifdef Q_OS_UNIX
+  // a group of its own, so that cancelCompile reaches the compiler too;
+  // speculative compiles yield to rendering
+  compiler->setChildProcessModifier([speculative]() {
+    ::setpgid(0, 0);
+    if (speculative) ::setpriority(PRIO_PROCESS, 0, 10);
+  });
+#endif
+  // the scripts report their steps on stdout
+  connect(compiler, &QProcess::readyReadStandardOutput, this, [this]() {
+    while (compiler->canReadLine()) {
+      QString line = QString::fromLocal8Bit(compiler->readLine()).trimmed();
+      if (!line.isEmpty() && !speculating) statusBar()->showMessage(line);
+    }
+  });
+  connect(compiler, &QProcess::finished, this, [this, b](int exitCode, QProcess::ExitStatus status) {
+    compiler->deleteLater();
+    compiler = nullptr;
+    bool load = !speculating;
+    speculating = false;
+    ui->actionStop->setEnabled(ui->itView->isRendering());
+    if (status != QProcess::NormalExit || exitCode != 0) {
       qDebug() << "Could not compile, code:" << exitCode;
-      QString errs = filesDirectory + "build/errors.txt";
-      QStringList errors;
-      QFile errsfile(errs);
-      if (errsfile.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        QTextStream stream(&errsfile);
-        QString errors = stream.readAll();
-        ui->errorsView->setPlainText(errors);
-        ui->errorsView->show();
-      }
+      if (!scratchSource.isEmpty()) QFile::remove(scratchSource);
+      scratchSource.clear();
+      if (load) codeHasChanged = true; // the loaded function is still the previous one
+      showCompileErrors();
+      statusBar()->showMessage(QString("Could not compile %1").arg(currFunction));
+      return;
+    }
+    qDebug() << "Compiled ok";
+    // keyed now, as the script creates the prefix if there was none
+    QString cached = libraryCache.store(keyOf(b), b.lib);
+    if (!scratchSource.isEmpty()) QFile::remove(scratchSource);
+    scratchSource.clear();
+    if (!load) {
+      codeHasErrors = false;
+      ui->errorsView->hide();
+      return;
+    }
+    if (!loadLibrary(cached.isEmpty() ? b.lib : cached, compileHash, startWhenLoaded)) {
+      QMessageBox msgBox;
+      msgBox.setText(QString("Failed to load function %1").arg(currFunction));
+      msgBox.exec();
+    }
+  });
+  qDebug() << "Will compile:" << b.cmd << args;
+  compiler->start(b.cmd, args);
+}
+
+void MainWindow::cancelCompile() {
+  if (compiler == nullptr) return;
+  compiler->disconnect(this);
+#ifdef Q_OS_UNIX
+  if (compiler->processId() > 0) ::kill(-(pid_t)compiler->processId(), SIGKILL);
+#endif
+#ifdef Q_OS_WIN
+  if (compiler->processId() > 0) QProcess::execute("taskkill", { "/T", "/F", "/PID", QString::number(compiler->processId()) });
+#endif
+  compiler->kill();
+  compiler->waitForFinished(1000);
+  delete compiler;
+  compiler = nullptr;
+  speculating = false;
+  if (!scratchSource.isEmpty()) QFile::remove(scratchSource);
+  scratchSource.clear();
+  qDebug() << "Compilation canceled";
+}
+
+void MainWindow::showCompileErrors() {
+  codeHasErrors = true;
+  QString errs = filesDirectory + "build/errors.txt";
+  QFile errsfile(errs);
+  if (errsfile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+    QTextStream stream(&errsfile);
+    showErrors(stream.readAll());
+  }
+}
+
+void MainWindow::showErrors(const QString &errors) {
+  codeHasErrors = true;
+  ui->errorsView->setPlainText(errors);
+  ui->errorsView->show();
+}
+
+// Libraries are loaded from the cache, under a name that changes with
+// their content, so a library is never reloaded under the name of another
+bool MainWindow::loadLibrary(const QString &lib, const QByteArray &hash, bool thenStart) {
+  QLibrary *newlib = dylib;
+  if (dylib == nullptr || dylib->fileName() != lib) { // the same (unchanged) one is kept loaded
+    newlib = new QLibrary(lib);
+    if (!newlib->load()) {
+      qDebug() << "Could not load: " << newlib->errorString();
+      delete newlib;
       return false;
     }
   }
+  //  typedef void (*DestroyFunctionPtr)(void*);
+  //  DestroyFunctionPtr destroyFunction = (DestroyFunctionPtr)dylib->resolve("_destroyFunction");
+  CreateFunction create = (CreateFunction)newlib->resolve("_createFunction");
+  DeleteFunction destroy = (DeleteFunction)newlib->resolve("_deleteFunction");
+  if (create == nullptr || destroy == nullptr) {
+    qDebug() << "Could not resolve function";
+    if (newlib != dylib) {
+      newlib->unload();
+      delete newlib;
+    }
+    return false;
+  }
+  Function *f = create(1); // param space first
+  f->other = create(0); // dyn space is other
+  f->other->other = f;
+  swapFunction(f, newlib, create, destroy);
+  ui->errorsView->hide();
+  functionLoaded(hash, thenStart);
+  return true;
+}
+
+// Replace the current function, once nothing renders with it any more
+void MainWindow::swapFunction(Function *f, QLibrary *lib, CreateFunction create, DeleteFunction destroy) {
+  ui->itView->stopRender();
+  history.clear();
+  state = nullptr;
+
+  if (function != nullptr) {
+    if (deletefun) {
+      deletefun(function->other);
+      deletefun(function);
+    } else {
+      delete function->other;
+      delete function;
+    }
+  }
+  if (dylib != nullptr && dylib != lib) {
+#ifdef Q_OS_LINUX
+    while (dylib->isLoaded()) dylib->unload();
+#else
+    dylib->unload();
+#endif
+    delete dylib;
+  }
+  function = f;
+  dylib = lib;
+  createfun = create;
+  deletefun = destroy;
+}
+
+// A separate object for the current function f (or its other) with the same
+// arguments: its copy(), or a new one from the library if the class has no
+// copy. nullptr if neither works. Delete it like copies, with delete.
+Function *MainWindow::newInstance(Function *f) {
+  Function *copied = f->copy_();
+  if (copied != f) return copied;
+  if (createfun == nullptr) return nullptr;
+  Function *g = createfun(f->pspace);
+  g->copyArgsFrom(f);
+  g->iscopy = true;
+  return g;
+}
+
+void MainWindow::functionLoaded(const QByteArray &hash, bool thenStart) {
+  functionHash = hash;
   function->defaults();
   function->other->defaults();
   int pspace = ui->pspace_radio->isChecked() ? 1 : 0;
@@ -1216,12 +1508,12 @@ bool MainWindow::compileAndLoad(const QString &fname, bool builtin_, bool thenSt
   ui->paramsTableView->show();
 
   ui->itView->clear();
+  ui->actionStart->setEnabled(true);
   statusBar()->showMessage(QString("Loaded %1").arg(currFunction));
 
   if (thenStart) {
     start();
   }
-  return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1238,6 +1530,7 @@ void MainWindow::on_actionCheat_Sheet_triggered() {
       "<li>Key T: thumbnail on/off (parameter space)</li>"
       "<li>Key P: set mouse position as parameter, goto dynamical space</li>"
       "<li>Key D: goto parameter space</li>"
+      "<li>Key M: pan mode on/off; drag to pan, wheel to zoom 2x</li>"
       "<li>Alt-left-drag: draw </li>"
       "<li>Keys 1-9: set orbit length</li>"
       "<li>Key 0: reset orbit</li>"
@@ -8,6 +8,9 @@
 #include "State.h"
 #include "paramsmodel.h"
 #include "tree.h"
+#include "rendercache.h"
+#include "history.h"
+#include "librarycache.h"
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -15,6 +18,8 @@ QT_END_NAMESPACE
 
 class Jupyter;
 class QLibrary;
+class QProcess;
+class QTimer;
 class SyntaxHighlighterCPP;
 typedef Function *(*CreateFunction)(int pspace);
 typedef void (*DeleteFunction)(void*);
@@ -26,6 +31,7 @@ public:
   MainWindow(bool dark, QWidget *parent = nullptr);
   ~MainWindow();
   void postInit();
+  Function *newInstance(Function *f);
 
 public slots:
   void show_about();
@@ -69,6 +75,7 @@ private slots:
   void on_jupyterReady();
   void on_jupyterFailed();
   void on_actionNew_Function_triggered();
+  void on_actionNew_Formula_triggered();
   void on_actionSave_triggered();
   void on_actionSave_As_triggered();
   void on_actionRevert_to_saved_triggered();
@@ -99,7 +106,7 @@ private:
   SyntaxHighlighterCPP *highlighter;
 
   QLibrary *dylib;
-  QMap<QString,int> ver;
+  QString functionArch; // instruction set for compiled functions, e.g. "x86-64-v3" (setting "functionArch")
   CreateFunction createfun;
   DeleteFunction deletefun;
 
@@ -108,11 +115,38 @@ private:
   void saveFunctionList();
   void saveFunctionList_(QTextStream &ts, TreeItem *item);
   bool saveCode(const QString &name, const QString &code);
+  bool writeCode(const QString &path, const QString &code);
+  struct Build {        // a compile of a function, see buildOf
+    QString fname, source, lib, exe, script, runtime, cmd;
+    QString flags;      // profile and instruction set, for the library's key
+    bool debug;
+  };
+  Build buildOf(const QString &fname);
+  QByteArray keyOf(const Build &b);
   bool compileAndLoad(const QString &name, bool builtin_, bool thenStart);
+  void speculate();
+  void startCompile(const Build &b, const QByteArray &key, bool speculative);
+  bool loadLibrary(const QString &lib, const QByteArray &hash, bool thenStart);
+  void swapFunction(Function *f, QLibrary *lib, CreateFunction create, DeleteFunction destroy);
+  void functionLoaded(const QByteArray &hash, bool thenStart);
+  void showCompileErrors();
+  void showErrors(const QString &errors);
+  void cancelCompile();
+  QProcess *compiler;        // the compile script while it runs, see compileAndLoad
+  bool speculating;          // compiler only fills libraryCache, see speculate
+  QString scratchSource;     // the copy of the edited code it compiles then
+  QByteArray compileKey;     // of the library it builds
+  QByteArray compileHash;    // of the code it builds, for functionLoaded
+  bool startWhenLoaded;      // Start was pressed while compiling
+  QTimer *speculateTimer;    // restarted by each edit
+  LibraryCache libraryCache; // compiled functions (setting "libraryCacheMB")
   void setFunction(const QString &name, bool thenStart);
   QString currFunction; // "Mandi"
   QString savedFunction; // "Mandi"
   void showDefaultCoordinates();
+  void getCoordinates(qdouble &xmin, qdouble &xmax, qdouble &ymin, qdouble &ymax);
+  int yresFor(int xres);
+
   QSet<QString> builtin;
   Function *function;
   bool codeHasChanged;
@@ -123,12 +157,21 @@ private:
   void setColormap(const QString &name);
 
   State *state;
-  std::vector<State*> history;
+  History history;         // compressed and spilled beyond "historyMB"
+  PixelFormat pixelFormat; // storage of rendered pixels (setting "pixelFormat")
+  double seedTolerance;    // reuse pixels of the last frame, see State::seedFrom (setting "seedTolerance")
+  int aaSamples;           // samples per edge pixel with Antialias checked (setting "antialiasSamples")
+  double aaThreshold;      // see Renderer::aaThreshold (setting "antialiasThreshold")
+  RenderCache renderCache; // finished frames on disk (setting "renderCacheMB")
+  QByteArray functionHash; // of the loaded function's code, for renderCache
+  QString renderKey;       // of the frame being rendered, if it is to be cached
+
   ParamsModel *paramsmodel;
   TreeModel *treemodel;
 
   Jupyter *jupyter;
 public:
+  void showCoordinates(const qdouble &cx, const qdouble &cy, double w, double h);
   QString filesDirectory;
   QString resourceDirectory;
   QString exportDirectory;
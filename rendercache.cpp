@@ -0,0 +1,112 @@
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDebug>
+
+#include "rendercache.h"
+#include "Function.h"
+#include "State.h"
+
+#define CACHE_MAGIC 0x49545243 // "ITRC"
+#define CACHE_VERSION 1
+
+RenderCache::RenderCache() {
+  budget = (qint64)512 << 20;
+  used = -1;
+}
+
+void RenderCache::setDirectory(const QString &dir) {
+  directory = dir;
+  if (!directory.isEmpty() && !directory.endsWith("/")) directory += "/";
+  if (!directory.isEmpty()) QDir().mkpath(directory);
+  used = -1;
+}
+
+void RenderCache::setBudget(qint64 bytes) {
+  budget = bytes;
+  if (isEnabled()) evict();
+}
+
+/*static*/ QString RenderCache::keyOf(const QByteArray &source, Function *f, State *state, int aaSamples, double aaThreshold) {
+  QString key = QCoreApplication::applicationVersion() + " " + QString::fromLatin1(source.toHex());
+  key += QString(" %1 %2").arg(QString::fromStdString(f->name)).arg(f->pspace);
+  for (int i = 0; i < f->args.count(); i++) {
+    ItArg *arg = f->args.getArgAt(i);
+    key += QString(" %1=%2").arg(QString::fromStdString(arg->name()), QString::fromStdString(arg->toString()));
+  }
+  key += QString(" %1,%2 ").arg(QString::fromStdString(state->centerx.toString()), QString::fromStdString(state->centery.toString()));
+  key += QString::asprintf("%.17g,%.17g %dx%d %d/%d", state->spanx, state->spany,
+                           state->getWidth(), state->getHeight(), (int)state->getPixelFormat(), state->getTileWidth());
+  if (aaSamples > 0) key += QString::asprintf(" aa%d/%.17g", aaSamples, aaThreshold);
+  return key;
+}
+
+QString RenderCache::fileOf(const QString &key) {
+  return directory + QString::fromLatin1(QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex()) + ".itrc";
+}
+
+// magic, version, key, then the frame (see State::writeFrame) compressed
+bool RenderCache::load(const QString &key, State *state) {
+  if (!isEnabled()) return false;
+  QFile file(fileOf(key));
+  if (!file.open(QIODevice::ReadWrite)) return false; // writable to touch it
+  qint64 size = file.size();
+  const uchar *data = file.map(0, size);
+  if (data == nullptr) return false;
+  QByteArray bytes = QByteArray::fromRawData((const char *)data, size);
+  QDataStream in(bytes);
+  quint32 magic, version;
+  QString stored;
+  in >> magic >> version >> stored;
+  if (in.status() != QDataStream::Ok || magic != CACHE_MAGIC || version != CACHE_VERSION || stored != key) return false;
+  qint64 pos = in.device()->pos();
+  QByteArray frame = qUncompress(data + pos, size - pos);
+  if (!state->readFrame((const byte *)frame.constData(), frame.size())) return false;
+  file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime); // recently used
+  return true;
+}
+
+void RenderCache::store(const QString &key, State *state) {
+  if (!isEnabled()) return;
+  QByteArray frame(state->frameSize(), Qt::Uninitialized);
+  state->writeFrame((byte *)frame.data());
+  QByteArray payload = qCompress(frame, 1); // fast; higher levels gain little on frames
+  frame = QByteArray();
+
+  QString name = fileOf(key);
+  qint64 old = QFileInfo(name).size();
+  QSaveFile file(name);
+  if (!file.open(QIODevice::WriteOnly)) return;
+  QDataStream out(&file);
+  out << (quint32)CACHE_MAGIC << (quint32)CACHE_VERSION << key;
+  out.writeRawData(payload.constData(), payload.size());
+  if (out.status() != QDataStream::Ok || !file.commit()) {
+    qDebug() << "Could not write render cache" << name;
+    return;
+  }
+  if (used < 0) scan();
+  else used += QFileInfo(name).size() - old;
+  evict();
+}
+
+void RenderCache::scan() {
+  used = 0;
+  QDir dir(directory);
+  for (const QFileInfo &info: dir.entryInfoList({"*.itrc"}, QDir::Files)) used += info.size();
+}
+
+// Oldest modification time first: load touches the files it reads
+void RenderCache::evict() {
+  if (used < 0) scan();
+  if (used <= budget) return;
+  QDir dir(directory);
+  for (const QFileInfo &info: dir.entryInfoList({"*.itrc"}, QDir::Files, QDir::Time | QDir::Reversed)) {
+    if (used <= budget) break;
+    if (QFile::remove(info.absoluteFilePath())) used -= info.size();
+  }
+}
@@ -0,0 +1,36 @@
+#ifndef RENDERCACHE_H
+#define RENDERCACHE_H
+
+#include <QString>
+#include <QByteArray>
+
+class Function;
+class State;
+
+// Finished frames on disk, so that returning to a view, a parameter set or
+// a function rendered before (also in an earlier session) is instant.
+// A frame is keyed by everything its pixels depend on: the function source,
+// space and arguments, the window, resolution and storage. Files hold the
+// compressed State storage and antialiasing samples; they are memory-mapped
+// to load, and the least recently used are deleted beyond the budget.
+class RenderCache {
+public:
+  RenderCache();
+  void setDirectory(const QString &dir);
+  void setBudget(qint64 bytes); // 0 disables the cache
+  bool isEnabled() { return budget > 0 && !directory.isEmpty(); }
+  // source: a hash of the function's code, see MainWindow::compileAndLoad
+  static QString keyOf(const QByteArray &source, Function *function, State *state, int aaSamples, double aaThreshold);
+  // Fill state (sized and tiled as when stored) from the cache; false on a miss
+  bool load(const QString &key, State *state);
+  void store(const QString &key, State *state);
+private:
+  QString directory;
+  qint64 budget;
+  qint64 used;           // bytes of all cache files, -1 until scanned
+  QString fileOf(const QString &key);
+  void scan();
+  void evict();
+};
+
+#endif // RENDERCACHE_H